@@ -0,0 +1,276 @@
+// Times the minimax search over a fixed set of positions, for comparing one
+// build with another.
+//
+// Each position is searched on its own with one thread, an empty table and
+// Zobrist keys made from a fixed seed, deepening a full move at a time until
+// the depth limit, or until the node limit is passed (the depth that passes
+// it is finished), or until deeper searches can't find anything new. Nothing
+// depends on the clock, so every run searches exactly the same nodes; the
+// signature of each position's search (its hash, depth, node count and
+// principal variation) is folded into a checksum that changes if the search
+// does. Positions where the players are already apart are skipped, since
+// the minimax search is never used there.
+//
+// Reported for each position and in total: nodes a second, time to each
+// depth, the transposition table hit rate and the effective branching
+// factor, which is the growth in nodes per ply from the first depth to the
+// last. With -r the positions are searched that many times and the fastest
+// run of each is kept.
+//
+// "make bench" runs it over every map, and over positions/, which holds
+// midgame and endgame boards recorded from the bot playing itself.
+//
+//   benchmark [-d depth] [-n nodes] [-r runs] [-s seed] [-m megabytes] [-j] [-i] positions...
+
+#include "Engine.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+#include <time.h>
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// what one depth of one position's search took
+struct DepthResult
+{
+    int depth;
+    long nodes; // at this depth alone
+    double seconds; // from the start of the position's search
+};
+
+struct PositionResult
+{
+    const char *name;
+    bool skipped;
+    std::vector<DepthResult> depths;
+    long nodes, probes, hits;
+    double seconds;
+    Direction move;
+    uint64_t signature;
+
+    double effectiveBranching() const;
+};
+
+double PositionResult::effectiveBranching() const
+{
+    if (depths.size() < 2 || depths.front().nodes == 0)
+        return 0;
+    const DepthResult &first = depths.front(), &last = depths.back();
+    return pow(double(last.nodes) / first.nodes,
+            1.0 / (last.depth - first.depth));
+}
+
+struct Bench
+{
+    int maxDepth;
+    long nodeLimit;
+};
+
+static void searchPosition(const Bench &bench, SearchContext &context,
+        GameTree &tree, Map map, PositionResult &result)
+{
+    context.newGame(map.width(), map.height());
+    map.setZobrist(&context.zobrist);
+    tree.newGame();
+    context.table.newSearch();
+
+    result.depths.clear();
+    result.nodes = result.probes = result.hits = 0;
+    result.move = NORTH;
+
+    // the same cap decideMoveMinimax puts on the deepening
+    int maxDepth = std::min(bench.maxDepth,
+            2 * (std::min(countReachableSquares(map, SELF),
+                    countReachableSquares(map, ENEMY)) + 1));
+
+    double started = now();
+    for (int depth = 2; depth <= maxDepth; depth += 2) {
+        context.deadline.startUnlimited();
+        bool carryOn = tree.decideMove(map, depth, &result.move);
+
+        DepthResult d = {depth, tree.nodeCount(), now() - started};
+        result.depths.push_back(d);
+        result.nodes += tree.nodeCount();
+        result.probes += tree.probeCount();
+        result.hits += tree.hitCount();
+
+        // a decided game has nothing more to search
+        if (!carryOn)
+            break;
+        if (bench.nodeLimit > 0 && result.nodes >= bench.nodeLimit)
+            break;
+    }
+    result.seconds = now() - started;
+
+    uint64_t sig = mix(map.hash());
+    sig = mix(sig ^ uint64_t(result.depths.size()));
+    sig = mix(sig ^ uint64_t(result.nodes));
+    const std::vector<Direction> &pv = tree.principalVariation();
+    for (size_t i = 0; i < pv.size(); ++i)
+        sig = mix(sig ^ uint64_t(pv[i] + 1));
+    result.signature = sig;
+}
+
+static bool loadPosition(const char *file, Map &map)
+{
+    FILE *fp = fopen(file, "r");
+    if (!fp) {
+        perror(file);
+        return false;
+    }
+    bool ok = map.readFromFile(fp);
+    fclose(fp);
+    if (!ok)
+        fprintf(stderr, "%s: not a board\n", file);
+    return ok;
+}
+
+static double percent(long part, long whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-d depth] [-n nodes] [-r runs] [-s seed] [-m megabytes] [-j] [-i] positions...\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    Bench bench;
+    bench.maxDepth = 20;
+    bench.nodeLimit = 2000000;
+    int runs = 1;
+
+    SearchOptions options;
+    options.threads = 1;
+    options.zobristSeed = 0x7472306e;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:r:s:m:ji")) != -1) {
+        switch (opt) {
+            case 'd': bench.maxDepth = atoi(optarg); break;
+            case 'n': bench.nodeLimit = atol(optarg); break;
+            case 'r': runs = atoi(optarg); break;
+            case 's': options.zobristSeed = strtoull(optarg, NULL, 0); break;
+            case 'm': options.hashMegabytes = atoi(optarg); break;
+            case 'j': options.jointSearch = true; break;
+            case 'i': options.incrementalTerritory = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind >= argc || bench.maxDepth < 2 || runs < 1 ||
+            options.zobristSeed == 0 || options.hashMegabytes < 1)
+        usage(argv[0]);
+
+    SearchContext context(options);
+    GameTree tree(context.table, context.deadline, context.options, false);
+
+    std::vector<PositionResult> results;
+    for (int i = optind; i < argc; ++i) {
+        Map map;
+        if (!loadPosition(argv[i], map))
+            return 1;
+
+        PositionResult result;
+        result.name = argv[i];
+        result.skipped = isOpponentIsolated(map);
+        if (result.skipped) {
+            printf("%-36s skipped, the players are apart\n", result.name);
+            results.push_back(result);
+            continue;
+        }
+
+        searchPosition(bench, context, tree, map, result);
+        for (int r = 1; r < runs; ++r) {
+            PositionResult again;
+            searchPosition(bench, context, tree, map, again);
+            if (again.signature != result.signature)
+                fprintf(stderr, "%s: searched differently on run %d\n",
+                        result.name, r + 1);
+            if (again.seconds < result.seconds) {
+                again.name = result.name;
+                again.skipped = false;
+                result = again;
+            }
+        }
+
+        printf("%-36s depth %2d %10ld nodes %8.1f ms %7.0f knps  ebf %5.2f  tt %5.1f%%  %-5s %016llx\n",
+                result.name, result.depths.back().depth, result.nodes,
+                result.seconds * 1000, result.nodes / result.seconds / 1000,
+                result.effectiveBranching(),
+                percent(result.hits, result.probes), dirToString(result.move),
+                (unsigned long long)result.signature);
+        fflush(stdout);
+        results.push_back(result);
+    }
+
+    long nodes = 0, probes = 0, hits = 0;
+    double seconds = 0, logBranching = 0;
+    int searched = 0, branchings = 0, deepest = 0;
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const PositionResult &result = results[i];
+        if (result.skipped)
+            continue;
+        ++searched;
+        nodes += result.nodes;
+        probes += result.probes;
+        hits += result.hits;
+        seconds += result.seconds;
+        deepest = std::max(deepest, result.depths.back().depth);
+        if (result.effectiveBranching() > 0) {
+            logBranching += log(result.effectiveBranching());
+            ++branchings;
+        }
+        checksum = mix(checksum ^ result.signature);
+    }
+
+    // how long the positions that got to each depth took to get there
+    printf("\ntime to depth:\n");
+    for (int depth = 2; depth <= deepest; depth += 2) {
+        int reached = 0;
+        double total = 0;
+        for (size_t i = 0; i < results.size(); ++i) {
+            const PositionResult &result = results[i];
+            if (result.skipped)
+                continue;
+            for (size_t j = 0; j < result.depths.size(); ++j) {
+                if (result.depths[j].depth == depth) {
+                    ++reached;
+                    total += result.depths[j].seconds;
+                }
+            }
+        }
+        printf("  depth %2d: %3d positions, %10.1f ms\n", depth, reached,
+                total * 1000);
+    }
+
+    printf("\n%d positions searched, %d skipped\n", searched,
+            int(results.size()) - searched);
+    printf("nodes:     %ld\n", nodes);
+    printf("time:      %.3f s\n", seconds);
+    printf("nodes/sec: %.0f\n", seconds > 0 ? nodes / seconds : 0.0);
+    printf("tt hits:   %.1f%% of %ld probes\n", percent(hits, probes), probes);
+    printf("ebf:       %.2f\n", branchings ? exp(logBranching / branchings) : 0.0);
+    printf("checksum:  %016llx\n", (unsigned long long)checksum);
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include "Bitboard.h"
+#include <cstring>
+
+void Bitboard::clear()
+{
+    if (!bits.empty())
+        memset(&bits.front(), 0, bits.size() * sizeof(uint64_t));
+}
+
+void Bitboard::setBorder()
+{
+    const uint64_t ones = ~uint64_t(0);
+
+    for (int i = 0; i < wordsPerRow; ++i) {
+        bits[i] = ones;
+        bits[(h + 1) * wordsPerRow + i] = ones;
+    }
+
+    // the left padding column, and everything right of the last square
+    for (int y = 1; y <= h; ++y) {
+        uint64_t *row = &bits[y * wordsPerRow];
+        row[0] |= 1;
+        for (int x = w + 1; x < wordsPerRow * 64; ++x)
+            row[x >> 6] |= uint64_t(1) << (x & 63);
+    }
+}
+
+int Bitboard::popcount() const
+{
+    int cnt = 0;
+    for (size_t i = 0; i < bits.size(); ++i)
+        cnt += __builtin_popcountll(bits[i]);
+    return cnt;
+}
+
+// The rows are laid out back to back, so shifting the board one square east
+// or west is a shift of the whole array by one bit. Bits that cross from the
+// end of one row into the start of the next only ever come from (or land in)
+// padding columns, which is why the padding of in has to be clear.
+void bbNeighbours(Bitboard &out, const Bitboard &in)
+{
+    const int stride = in.stride();
+    const int end = (in.height() + 1) * stride;
+    const uint64_t *src = in.words();
+    uint64_t *dst = out.words();
+
+    for (int i = 0; i < stride; ++i) {
+        dst[i] = 0;
+        dst[end + i] = 0;
+    }
+
+    for (int i = stride; i < end; ++i) {
+        dst[i] = (src[i] << 1) | (src[i - 1] >> 63) |
+            (src[i] >> 1) | (src[i + 1] << 63) |
+            src[i - stride] | src[i + stride];
+    }
+}
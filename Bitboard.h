@@ -0,0 +1,162 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "position.h"
+
+// A board with one bit per square, stored as rows of 64-bit words. Every row
+// has a padding column on each side (plus whatever is left over in its last
+// word), and there is a padding row above and below the board, so the
+// neighbours of any square on the board can be read without bounds checks.
+// Square (x, y) lives at bit x+1 of row y+1.
+//
+// A freshly created board has every bit clear, including the padding. Wall
+// boards call setBorder() so the padding reads as walls, while boards used
+// as masks or frontiers for the word-parallel operations keep it clear.
+class Bitboard
+{
+    public:
+        Bitboard();
+        Bitboard(int width, int height);
+
+        int width() const;
+        int height() const;
+
+        // number of 64-bit words in each row, and in the whole board
+        int stride() const;
+        int size() const;
+
+        // bit number of a square, usable to index per-square scratch arrays
+        // of length cells()
+        int bitIndex(position pos) const;
+        int cells() const;
+
+        bool get(position pos) const;
+        void set(position pos);
+        void reset(position pos);
+
+        bool test(int bit) const;
+        void set(int bit);
+        void reset(int bit);
+
+        // clear every bit, including the padding
+        void clear();
+        // set every padding bit, leaving the squares of the board alone
+        void setBorder();
+
+        int popcount() const;
+
+        uint64_t *words();
+        const uint64_t *words() const;
+
+    private:
+        int w, h, wordsPerRow;
+        std::vector<uint64_t> bits;
+};
+
+// out = squares orthogonally adjacent to a set bit of in. The padding of in
+// must be clear; the padding of out may pick up stray bits, so the result is
+// normally masked with a board whose padding is clear. out must already have
+// the same dimensions as in.
+void bbNeighbours(Bitboard &out, const Bitboard &in);
+
+inline
+Bitboard::Bitboard() :
+    w(0), h(0), wordsPerRow(0)
+{
+}
+
+inline
+Bitboard::Bitboard(int width, int height) :
+    w(width), h(height), wordsPerRow((width + 2 + 63) / 64),
+    bits((height + 2) * wordsPerRow, 0)
+{
+}
+
+inline
+int Bitboard::width() const
+{
+    return w;
+}
+
+inline
+int Bitboard::height() const
+{
+    return h;
+}
+
+inline
+int Bitboard::stride() const
+{
+    return wordsPerRow;
+}
+
+inline
+int Bitboard::size() const
+{
+    return bits.size();
+}
+
+inline
+int Bitboard::bitIndex(position pos) const
+{
+    return (pos.y + 1) * wordsPerRow * 64 + pos.x + 1;
+}
+
+inline
+int Bitboard::cells() const
+{
+    return bits.size() * 64;
+}
+
+inline
+bool Bitboard::test(int bit) const
+{
+    return (bits[bit >> 6] >> (bit & 63)) & 1;
+}
+
+inline
+void Bitboard::set(int bit)
+{
+    bits[bit >> 6] |= uint64_t(1) << (bit & 63);
+}
+
+inline
+void Bitboard::reset(int bit)
+{
+    bits[bit >> 6] &= ~(uint64_t(1) << (bit & 63));
+}
+
+inline
+bool Bitboard::get(position pos) const
+{
+    return test(bitIndex(pos));
+}
+
+inline
+void Bitboard::set(position pos)
+{
+    set(bitIndex(pos));
+}
+
+inline
+void Bitboard::reset(position pos)
+{
+    reset(bitIndex(pos));
+}
+
+inline
+uint64_t *Bitboard::words()
+{
+    return &bits.front();
+}
+
+inline
+const uint64_t *Bitboard::words() const
+{
+    return &bits.front();
+}
+
+#endif
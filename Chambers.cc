@@ -0,0 +1,130 @@
+#include "Chambers.h"
+#include <algorithm>
+
+static inline position neighbour(position pos, int dir)
+{
+    switch (dir) {
+        case 0: return pos.north();
+        case 1: return pos.south();
+        case 2: return pos.west();
+        default: return pos.east();
+    }
+}
+
+// A path alternates colours, so starting on the entrance's colour it can
+// visit at most one more square of that colour than of the other.
+static inline int parityFill(int cells, int checkerDiff)
+{
+    int same = (cells + checkerDiff) / 2;
+    int other = cells - same;
+    if (same > other)
+        return 2 * other + 1;
+    else
+        return 2 * same;
+}
+
+ChamberTree::ChamberTree() :
+    generation(0)
+{
+}
+
+void ChamberTree::build(const Bitboard &board, position start)
+{
+    if (slots.size() < size_t(board.cells())) {
+        Slot empty = {0, 0};
+        slots.assign(board.cells(), empty);
+        generation = 0;
+    }
+    if (++generation == 0) {
+        for (size_t i = 0; i < slots.size(); ++i)
+            slots[i].generation = 0;
+        generation = 1;
+    }
+
+    stack.clear();
+    found.clear();
+    visitOrder.clear();
+
+    int counter = 0;
+
+    Slot &startSlot = slots[board.bitIndex(start)];
+    startSlot.generation = generation;
+    startSlot.disc = counter++;
+    visitOrder.push_back(start);
+
+    Frame root = {start, 0, 0, 0, 1, 1, 0};
+    stack.push_back(root);
+
+    while (true) {
+        Frame &f = stack.back();
+
+        if (f.dir < 4) {
+            position next = neighbour(f.pos, f.dir++);
+
+            // checked before the wall test, since the start square may be
+            // a wall
+            Slot &slot = slots[board.bitIndex(next)];
+            if (slot.generation == generation) {
+                // seen already; the edge back to the parent lowers low to
+                // the parent's disc, which doesn't change which squares
+                // come out as articulation squares
+                f.low = std::min(f.low, slot.disc);
+                continue;
+            }
+
+            if (board.get(next))
+                continue;
+
+            slot.generation = generation;
+            slot.disc = counter++;
+            visitOrder.push_back(next);
+
+            // colours are relative to the square's own, so the parent's
+            // running difference can just subtract the child's
+            Frame child = {next, 0, slot.disc, slot.disc, 1, 1, 0};
+            stack.push_back(child); // invalidates f
+            continue;
+        }
+
+        if (stack.size() == 1)
+            break;
+
+        Frame done = f;
+        stack.pop_back();
+        Frame &parent = stack.back();
+
+        if (done.low >= parent.disc) {
+            // nothing below done gets back above parent without going
+            // through it, so done's subtree is a pocket of parent's chamber
+            Chamber c;
+            c.entrance = done.pos;
+            c.first = done.disc;
+            c.squares = counter - done.disc;
+            c.cells = done.cells;
+            c.checkerDiff = done.checkerDiff;
+            c.fill = parityFill(done.cells, done.checkerDiff) + done.best;
+            found.push_back(c);
+
+            parent.best = std::max(parent.best, c.fill);
+        } else {
+            parent.low = std::min(parent.low, done.low);
+            parent.cells += done.cells;
+            parent.checkerDiff -= done.checkerDiff;
+            parent.best = std::max(parent.best, done.best);
+        }
+    }
+
+    // nothing is visited before the start, so every subtree below it has a
+    // low no less than the start's disc and is split off as a pocket above;
+    // the start square's chamber is always just the start square with its
+    // pockets hanging off
+    Frame &f = stack.back();
+    Chamber c;
+    c.entrance = f.pos;
+    c.first = 0;
+    c.squares = counter;
+    c.cells = f.cells;
+    c.checkerDiff = f.checkerDiff;
+    c.fill = parityFill(f.cells, f.checkerDiff) + f.best;
+    found.push_back(c);
+}
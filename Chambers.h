@@ -0,0 +1,98 @@
+#ifndef CHAMBERS_H
+#define CHAMBERS_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "position.h"
+#include "Bitboard.h"
+
+// Splits the free squares reachable from a starting square into chambers,
+// using one depth first search that finds the articulation squares (Hopcroft
+// and Tarjan). Everything on the far side of an articulation square is a
+// pocket: once a path goes in it can never come back out, so it can finish
+// off at most one of the pockets hanging off the chamber it is in. Pockets
+// are split up the same way, which makes a tree of chambers rooted at the
+// starting square.
+//
+// Each chamber gets an upper bound on how many of its squares a path that
+// enters at its entrance can visit, from the checkerboard colouring of the
+// chamber, plus the best of its pockets. Corridors and dead ends come out as
+// chains of one square chambers.
+class ChamberTree
+{
+    public:
+        struct Chamber
+        {
+            // first square a path visits when it enters the chamber
+            position entrance;
+            // squares of the whole pocket (the chamber and everything
+            // hanging off it) are order()[first, first + squares)
+            int first, squares;
+            // squares of the chamber itself, not counting its pockets
+            int cells;
+            // squares of the entrance's colour minus squares of the other
+            int checkerDiff;
+            // most squares a path entering here could visit in the pocket
+            int fill;
+        };
+
+        ChamberTree();
+
+        // The start square is treated as free even if it is a wall (it is
+        // usually a player's square). The board is never written.
+        void build(const Bitboard &board, position start);
+
+        // most squares a path from the start square could visit, including
+        // the start square itself
+        int fill() const;
+
+        // every chamber found by the last build, pockets before the chambers
+        // they hang off; the last one is the start square's own chamber
+        const std::vector<Chamber> &chambers() const;
+
+        // reachable squares, in the order the search found them
+        const std::vector<position> &order() const;
+
+    private:
+        struct Frame
+        {
+            position pos;
+            int dir;
+            int disc, low;
+            int cells, checkerDiff, best;
+        };
+
+        struct Slot
+        {
+            uint32_t generation;
+            int disc;
+        };
+
+        std::vector<Slot> slots;
+        uint32_t generation;
+
+        std::vector<Frame> stack;
+        std::vector<Chamber> found;
+        std::vector<position> visitOrder;
+};
+
+inline
+int ChamberTree::fill() const
+{
+    return found.back().fill;
+}
+
+inline
+const std::vector<ChamberTree::Chamber> &ChamberTree::chambers() const
+{
+    return found;
+}
+
+inline
+const std::vector<position> &ChamberTree::order() const
+{
+    return visitOrder;
+}
+
+#endif
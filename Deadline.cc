@@ -0,0 +1,64 @@
+#include "Deadline.h"
+
+// calls to expired() between reads of the clock, on each thread
+static const int CHECK_INTERVAL = 32;
+
+// One countdown for each thread, shared by every Deadline the thread asks.
+// It can't be a member, since all the threads searching a turn ask the
+// same Deadline. A thread that goes from one Deadline to another only
+// carries over when the clock is next read, so the new one is still read
+// within CHECK_INTERVAL calls.
+static __thread int check_countdown;
+
+Deadline::Deadline() :
+    limited(false), isStopped(true)
+{
+    end.tv_sec = 0;
+    end.tv_nsec = 0;
+}
+
+void Deadline::start(double seconds)
+{
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long nsec = long(seconds * 1e9);
+    end.tv_sec += nsec / 1000000000;
+    end.tv_nsec += nsec % 1000000000;
+    if (end.tv_nsec >= 1000000000) {
+        ++end.tv_sec;
+        end.tv_nsec -= 1000000000;
+    }
+
+    limited = true;
+    setStopped(false);
+}
+
+void Deadline::startUnlimited()
+{
+    limited = false;
+    setStopped(false);
+}
+
+void Deadline::stop()
+{
+    setStopped(true);
+}
+
+bool Deadline::expired()
+{
+    if (stopped())
+        return true;
+
+    if (!limited || --check_countdown > 0)
+        return false;
+    check_countdown = CHECK_INTERVAL;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > end.tv_sec ||
+            (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec)) {
+        setStopped(true);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,55 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <time.h>
+
+// Tells the searches when to stop. Each engine has its own, which its main
+// thread starts at the top of each turn, and every search thread asks
+// expired() as it goes; once that is true the searches unwind on their
+// own, leaving the board and their path state as they found it. Only the
+// main thread may start it, and only while nothing is searching, but any
+// thread may stop it.
+class Deadline
+{
+    public:
+        Deadline();
+
+        // the search has this long from now
+        void start(double seconds);
+        // the search runs until stop() is called (used while pondering)
+        void startUnlimited();
+        // stops the search now
+        void stop();
+
+        // Whether the search should stop. The clock is only read every few
+        // calls on each thread, so a call per node is cheap enough.
+        bool expired();
+
+        // whether the search has been stopped, without reading the clock;
+        // for checking after a child search returns
+        bool stopped() const;
+
+    private:
+        timespec end;
+        bool limited;
+
+        // read by every search thread and set by any of them, so it is
+        // only touched through the __atomic builtins
+        bool isStopped;
+
+        void setStopped(bool value);
+};
+
+inline
+bool Deadline::stopped() const
+{
+    return __atomic_load_n(&isStopped, __ATOMIC_RELAXED);
+}
+
+inline
+void Deadline::setStopped(bool value)
+{
+    __atomic_store_n(&isStopped, value, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,140 @@
+#include "Engine.h"
+
+#include <unistd.h>
+
+SearchOptions::SearchOptions() :
+    threads(1), hashMegabytes(16), prefault(false), ponder(false),
+    marginMs(50), aspirationWindow(4), aspirationGrowth(4),
+    jointSearch(false), incrementalTerritory(false), tablebasePath(NULL),
+    zobristSeed(0),
+    telemetryPath(NULL)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 1)
+        threads = cpus;
+}
+
+SearchContext::SearchContext(const SearchOptions &options) :
+    options(options), time(deadline), tree(table, deadline, options),
+    searchedBefore(false), treeDepth(0), ponderDepth(0)
+{
+    // each entry takes 16 bytes
+    table.resize(size_t(options.hashMegabytes) * 1024 * 1024 / 16,
+            options.prefault);
+    time.setMargin(options.marginMs / 1000.0);
+}
+
+SearchContext::~SearchContext()
+{
+    for (size_t i = 0; i < helperTrees.size(); ++i)
+        delete helperTrees[i];
+}
+
+void SearchContext::newGame(int width, int height)
+{
+    if (options.zobristSeed)
+        zobrist.init(width, height, options.zobristSeed);
+    else
+        zobrist.init(width, height);
+    table.clear();
+    fillTable.clear();
+    tree.newGame();
+    searchedBefore = false;
+    treeDepth = 0;
+}
+
+
+// Opens the log options ask for, and returns the options to search with:
+// the same, but without the log if it couldn't be opened (which has
+// already said why), so that nothing is timed for nowhere.
+static SearchOptions openTelemetry(TelemetryLog &log, SearchOptions options)
+{
+    if (options.telemetryPath && !log.open(options.telemetryPath))
+        options.telemetryPath = NULL;
+    return options;
+}
+
+Engine::Engine(const SearchOptions &options) :
+    context(openTelemetry(telemetry, options)), helpers(options.threads - 1),
+    ponderer(options.ponder ? 1 : 0), pondering(false)
+{
+    turn.game = 0;
+    turn.turn = 0;
+    turn.isolated = false;
+    turn.move = NORTH;
+    turn.depth = 0;
+    turn.threads = options.threads;
+    turn.ticks = 0;
+    turn.elapsed = 0;
+    turn.remaining = 0;
+}
+
+Engine::~Engine()
+{
+    stopPondering();
+}
+
+void Engine::newGame(const Map &map)
+{
+    stopPondering();
+    context.newGame(map.width(), map.height());
+    current = map;
+    current.setZobrist(&context.zobrist);
+    ++turn.game;
+    turn.turn = 0;
+}
+
+Direction Engine::decide(const Map &board, double seconds)
+{
+    stopPondering();
+    if (board.width() != context.zobrist.width() ||
+            board.height() != context.zobrist.height())
+        newGame(board);
+
+    current = board;
+    current.setZobrist(&context.zobrist);
+    return decide(seconds);
+}
+
+Direction Engine::decide(double seconds)
+{
+    stopPondering();
+    context.time.startTurn(seconds);
+    context.turnStats.clear();
+    uint64_t started = telemetryTicks();
+
+    Direction move;
+    turn.isolated = isOpponentIsolated(current);
+    if (turn.isolated)
+        move = decideMoveIsolatedFromOpponent(current, context, helpers);
+    else
+        move = decideMoveMinimax(current, context, helpers);
+
+    ++turn.turn;
+    turn.move = move;
+    turn.depth = turn.isolated ? 0 : context.treeDepth;
+    turn.stats = context.turnStats;
+    turn.ticks = telemetryTicks() - started;
+    turn.elapsed = context.time.elapsed();
+    turn.remaining = context.time.remaining();
+    telemetry.write(turn);
+
+    if (context.options.ponder)
+        pondering = startPondering(current, move, context, ponderer);
+    return move;
+}
+
+void Engine::observe(Direction mine, Direction theirs)
+{
+    stopPondering();
+    current.move(mine, SELF);
+    current.move(theirs, ENEMY);
+}
+
+void Engine::stopPondering()
+{
+    if (!pondering)
+        return;
+    ::stopPondering(context, ponderer);
+    pondering = false;
+}
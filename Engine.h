@@ -0,0 +1,138 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "Map.h"
+#include "MoveDeciders.h"
+#include "GameTree.h"
+#include "Deadline.h"
+#include "TimeManager.h"
+#include "ThreadPool.h"
+#include "Telemetry.h"
+
+// Everything the searches for one game keep, from one turn to the next and
+// between the threads searching a turn. The deciders are handed one of
+// these rather than sharing globals, so any number of games can be played
+// at once in one process as long as each has its own.
+struct SearchContext
+{
+    SearchOptions options;
+
+    // the keys every map of the game is hashed with
+    Zobrist zobrist;
+
+    // the minimax searches' table, and the isolated fill search's memo
+    // (see OpponentIsolated.cc)
+    TranspositionTable table;
+    TranspositionTable fillTable;
+
+    Deadline deadline;
+    TimeManager time;
+
+    // The main minimax search's tree, along with the position it was last
+    // searched from and how deep it got (see decideMoveMinimax).
+    GameTree tree;
+    Map treeMap;
+    bool searchedBefore;
+    int treeDepth;
+
+    // A tree for each helper thread, made the first time that helper is
+    // used and started over every turn. Each tree reserves its whole node
+    // block up front, which is too costly to do for every turn.
+    std::vector<GameTree *> helperTrees;
+
+    // where the ponderer picks up the tree
+    Map ponderMap;
+    int ponderDepth;
+
+    // what the minimax search counted this turn, on every thread
+    SearchStats turnStats;
+
+    explicit SearchContext(const SearchOptions &options);
+    ~SearchContext();
+
+    // forgets everything searched so far, and draws new keys for a board
+    // of the given size
+    void newGame(int width, int height);
+
+    private:
+        SearchContext(const SearchContext &);
+        SearchContext &operator=(const SearchContext &);
+};
+
+// A whole bot behind a few calls, for running it in-process. An engine
+// owns its search state and threads (options.threads - 1 helpers, and one
+// more to ponder with if options.ponder is set); only the tablebase is
+// shared, and opening a file for it is left to the caller. An engine is
+// only to be called from one thread at a time.
+class Engine
+{
+    public:
+        explicit Engine(const SearchOptions &options);
+        ~Engine();
+
+        // Starts a game from map, forgetting the last one. The keys are
+        // sized to the map, so every later board has to be the same size.
+        void newGame(const Map &map);
+
+        // Decides the move from board, which must be from the current game,
+        // within seconds from now less options.marginMs. A new game is
+        // started if the board is a different size from the last.
+        Direction decide(const Map &board, double seconds);
+
+        // decides the move from where newGame() and observe() have got to
+        Direction decide(double seconds);
+
+        // Moves the engine's position on by the moves both players made,
+        // for callers that don't pass a board to decide().
+        void observe(Direction mine, Direction theirs);
+
+        // Pondering goes on from decide() until the next call into the
+        // engine, or until this is called.
+        void stopPondering();
+
+        // the position the next decide(seconds) is made from
+        const Map &currentBoard() const;
+
+        // the engine's search state, for inspecting after a decide()
+        const SearchContext &searchContext() const;
+
+        // what the last decide() did, which is also what goes to
+        // options.telemetryPath if that is set
+        const TurnRecord &lastTurn() const;
+
+    private:
+        // opened before the context is made, so that the searches are only
+        // timed if it did open
+        TelemetryLog telemetry;
+        TurnRecord turn;
+
+        SearchContext context;
+        ThreadPool helpers;
+        ThreadPool ponderer;
+
+        Map current;
+        bool pondering;
+
+        Engine(const Engine &);
+        Engine &operator=(const Engine &);
+};
+
+inline
+const Map &Engine::currentBoard() const
+{
+    return current;
+}
+
+inline
+const SearchContext &Engine::searchContext() const
+{
+    return context;
+}
+
+inline
+const TurnRecord &Engine::lastTurn() const
+{
+    return turn;
+}
+
+#endif
@@ -1,70 +1,145 @@
-#include "MoveDeciders.h"
+#include "GameTree.h"
+#include "Engine.h"
+#include "Voronoi.h"
+#include "ThreadPool.h"
+#include "TimeManager.h"
 #include <climits>
 #include <cstdio>
 #include <cstdlib>
-#include <deque>
+#include <vector>
 #include <utility>
-#include <stdexcept>
 #include <limits>
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 
 static const int INF = INT_MAX;
 
-static int heuristic(const Map &map);
+// most memory one tree may use for its nodes
+static const size_t TREE_MEMORY_LIMIT = 256 * 1024 * 1024;
+
+GameTree::GameTree(TranspositionTable &table, Deadline &deadline,
+        const SearchOptions &options, bool verbose) :
+    table(table), deadline(deadline),
+    aspirationWindow(options.aspirationWindow),
+    aspirationGrowth(options.aspirationGrowth),
+    jointMoves(options.jointSearch),
+    incremental(options.incrementalTerritory), territoryPly(0),
+    verbose(verbose), timed(options.telemetryPath != NULL),
+    lastScore(0), haveScore(false),
+    maxNodes(TREE_MEMORY_LIMIT / sizeof(Node))
+{
+    nodes.reserve(maxNodes);
+    reset();
+}
 
-class GameTree
+// throws the whole tree away at once
+void GameTree::reset()
 {
-    public:
-        GameTree();
-        ~GameTree();
+    nodes.clear();
+    freeList = NO_NODE;
+    freeCount = 0;
+
+    Node unused = {{NO_NODE, NO_NODE, NO_NODE, NO_NODE}, NORTH, false};
+    nodes.push_back(unused);
+    root = newNode(NORTH);
+
+    pathLength = 0;
+    killers.clear();
+    principal.clear();
+    haveScore = false;
+}
 
-        Direction decideMove(Map &map, int depth);
+GameTree::~GameTree()
+{
+}
 
-    private:
-        struct Node;
-        bool buildTreeTwoLevels(Node *node, const Map &map);
-        int negascout(Node *node, Map &map, int depth,
-                int alpha, int beta, int sign, Direction *dir);
+void GameTree::newGame()
+{
+    reset();
+    history.clear();
+}
 
-        struct Node
-        {
-            Node *children[4];
-            Direction dir;
+static inline Player signToPlayer(int sign)
+{
+    if (sign == 1)
+        return SELF;
+    else
+        return ENEMY;
+}
 
-            Node(Direction dir);
-            void promoteMove(int i);
-        };
+inline GameTree::Node &GameTree::at(NodeRef ref)
+{
+    return nodes[ref];
+}
 
-        Node *root;
+inline const GameTree::Node &GameTree::at(NodeRef ref) const
+{
+    return nodes[ref];
+}
 
-        std::deque<Node> nodesAlloc;
-};
+inline bool GameTree::haveRoom(size_t count) const
+{
+    return freeCount + (maxNodes - nodes.size()) >= count;
+}
 
-GameTree::GameTree()
+// only call after checking haveRoom
+inline GameTree::NodeRef GameTree::newNode(Direction dir)
 {
-    nodesAlloc.push_back(Node(NORTH));
+    Node fresh = {{NO_NODE, NO_NODE, NO_NODE, NO_NODE}, dir, false};
+
+    if (freeList != NO_NODE) {
+        NodeRef ref = freeList;
+        freeList = nodes[ref].children[0];
+        --freeCount;
+        nodes[ref] = fresh;
+        return ref;
+    }
 
-    root = &nodesAlloc.back();
+    nodes.push_back(fresh);
+    return nodes.size() - 1;
 }
 
-GameTree::~GameTree()
+inline void GameTree::freeNode(NodeRef ref)
 {
+    nodes[ref].children[0] = freeList;
+    freeList = ref;
+    ++freeCount;
 }
 
-static inline Player signToPlayer(int sign)
+void GameTree::freeBelow(NodeRef ref)
 {
-    if (sign == 1)
-        return SELF;
-    else
-        return ENEMY;
+    Node &n = at(ref);
+    for (int i = 0; i < 4 && n.children[i]; ++i) {
+        Node &mine = at(n.children[i]);
+        for (int j = 0; j < 4 && mine.children[j]; ++j) {
+            freeBelow(mine.children[j]);
+            freeNode(mine.children[j]);
+        }
+        freeNode(n.children[i]);
+        n.children[i] = NO_NODE;
+    }
+    // children built again come in direction order
+    n.ordered = false;
 }
 
-inline GameTree::Node::Node(Direction dir) :
-    dir(dir)
+// The moves after a cutoff weren't searched this time, so when the tree is
+// running out of room what is below them is the first thing to go. They
+// keep their own block of children, which is built along with them.
+void GameTree::freePruned(NodeRef ref, int i, int sign)
 {
-    for (int i = 0; i < 4; ++i) {
-        children[i] = NULL;
+    if (haveRoom(maxNodes / 4))
+        return;
+
+    Node &n = at(ref);
+    for (++i; i < 4 && n.children[i]; ++i) {
+        if (sign == 1) {
+            Node &mine = at(n.children[i]);
+            for (int j = 0; j < 4 && mine.children[j]; ++j)
+                freeBelow(mine.children[j]);
+        } else {
+            freeBelow(n.children[i]);
+        }
     }
 }
 
@@ -75,32 +150,352 @@ inline void GameTree::Node::promoteMove(int i)
     }
 }
 
-Direction GameTree::decideMove(Map &map, int depth)
+inline size_t GameTree::historyIndex(const Map &map, Player p,
+        Direction dir) const
+{
+    position pos = p == SELF ? map.my_pos() : map.enemy_pos();
+    return (size_t(p) * map.width() * map.height() +
+            pos.x * map.height() + pos.y) * 4 + dir;
+}
+
+void GameTree::orderMoves(Node &n, const Map &map, int sign)
+{
+    StatTimer timer(timed, stats.expandTicks);
+    const Killers &k = killers[pathLength];
+    Player p = signToPlayer(sign);
+
+    long score[4];
+    int cnt = 0;
+    for (; cnt < 4 && n.children[cnt]; ++cnt) {
+        Direction dir = at(n.children[cnt]).dir;
+        if (dir == k.moves[0])
+            score[cnt] = LONG_MAX;
+        else if (dir == k.moves[1])
+            score[cnt] = LONG_MAX - 1;
+        else
+            score[cnt] = history[historyIndex(map, p, dir)];
+    }
+
+    // ties keep the fixed direction order
+    for (int i = 1; i < cnt; ++i) {
+        for (int j = i; j > 0 && score[j - 1] < score[j]; --j) {
+            std::swap(score[j], score[j - 1]);
+            std::swap(n.children[j], n.children[j - 1]);
+        }
+    }
+    n.ordered = true;
+}
+
+inline void GameTree::recordCutoff(const Map &map, Direction dir, int sign,
+        int depth, int i)
+{
+    ++stats.cutoffs;
+    if (i == 0)
+        ++stats.firstMoveCutoffs;
+
+    Killers &k = killers[pathLength];
+    if (k.moves[0] != dir) {
+        k.moves[1] = k.moves[0];
+        k.moves[0] = dir;
+    }
+    history[historyIndex(map, signToPlayer(sign), dir)] += long(depth) * depth;
+}
+
+inline void GameTree::makeMove(Map &map, Direction dir, Player p)
+{
+    map.move(dir, p);
+    PathMove move = {p, p == SELF ? map.my_pos() : map.enemy_pos()};
+    path[pathLength++] = move;
+}
+
+inline void GameTree::unmakeMove(Map &map, Direction dir, Player p)
+{
+    --pathLength;
+    if (territoryPly > pathLength) {
+        territory.unmove();
+        territoryPly = pathLength;
+    }
+    map.unmove(dir, p);
+}
+
+bool GameTree::decideMove(Map &map, int depth, Direction *dir)
+{
+    Direction bestDir = NORTH;
+    stats.clear();
+
+    if (incremental) {
+        territory.reset(map.getBoard(), map.my_pos(), map.enemy_pos());
+        territoryPly = 0;
+    }
+
+    // what the earlier depths learned still counts, but for less
+    size_t historySize = size_t(2) * map.width() * map.height() * 4;
+    if (history.size() != historySize) {
+        history.assign(historySize, 0);
+    } else {
+        for (size_t i = 0; i < history.size(); ++i)
+            history[i] /= 2;
+    }
+    if (killers.size() < size_t(depth) + 1) {
+        Killers none = {{NO_KILLER, NO_KILLER}};
+        killers.resize(depth + 1, none);
+    }
+
+    followPV();
+
+    // The window starts around the last score and is widened on whichever
+    // side the score falls outside it, until it either lands inside or the
+    // window is full. Win and loss scores don't tell where the rest lie.
+    long delta = aspirationWindow;
+    int alpha = -INF, beta = INF;
+    if (delta > 0 && haveScore && lastScore > -INF && lastScore < INF) {
+        alpha = std::max(long(-INF), lastScore - delta);
+        beta = std::min(long(INF), lastScore + delta);
+    }
+
+    bool found = false;
+    int score;
+    while (true) {
+        score = searchRoot(map, depth, alpha, beta, &bestDir, &found);
+        if (deadline.stopped())
+            break;
+
+        if (score <= alpha && alpha > -INF) {
+            delta *= aspirationGrowth;
+            alpha = std::max(long(-INF), lastScore - delta);
+        } else if (score >= beta && beta < INF) {
+            delta *= aspirationGrowth;
+            beta = std::min(long(INF), lastScore + delta);
+        } else {
+            break;
+        }
+        if (verbose)
+            fprintf(stderr, "depth: %d score %d outside window, widening to (%d, %d)\n", depth, score, alpha, beta);
+    }
+    if (found)
+        *dir = bestDir;
+
+    if (deadline.stopped()) {
+        if (verbose && found)
+            fprintf(stderr, "depth: %d stopped, dir so far: %s\n", depth, dirToString(bestDir));
+        return false;
+    }
+
+    lastScore = score;
+    haveScore = true;
+    principal.assign(pvTable[0], pvTable[0] + pvLength[0]);
+
+    if (verbose) {
+        fprintf(stderr, "depth: %d, dir: %s, alpha: %d, pv:", depth, dirToString(bestDir), score);
+        for (size_t i = 0; i < principal.size(); ++i)
+            fprintf(stderr, " %s", dirToString(principal[i]));
+        fprintf(stderr, "\n");
+    }
+
+    if (score == -INF) {
+        if (verbose)
+            fprintf(stderr, "best alpha is -Infinity, we lose no matter what...\n");
+        return false;
+    }
+
+    return true;
+}
+
+// A move only takes over as the best once it is proven better than the
+// bottom of the window, which every move searched before it failed to
+// reach, so even a search that was stopped gives a move that can be used.
+int GameTree::searchRoot(Map &map, int depth, int alpha, int beta,
+        Direction *dir, bool *found)
 {
     Direction bestDir = NORTH;
+    int score;
+    if (jointMoves)
+        score = jointSearch(root, map, depth, alpha, beta, &bestDir);
+    else
+        score = negascout(root, map, depth, alpha, beta, 1, &bestDir);
+    if (score > alpha) {
+        *dir = bestDir;
+        *found = true;
+    }
+    return score;
+}
 
-    int alpha = negascout(root, map, depth, -INF, INF, 1, &bestDir);
+// the moves of the last principal variation are put first, as far down the
+// tree as it still goes
+void GameTree::followPV()
+{
+    NodeRef ref = root;
+    for (size_t p = 0; p < principal.size(); ++p) {
+        Node &n = at(ref);
+        int i = 0;
+        while (i < 4 && n.children[i] && at(n.children[i]).dir != principal[p])
+            ++i;
+        if (i == 4 || !n.children[i])
+            break;
+        n.promoteMove(i);
+        ref = n.children[0];
+    }
+}
 
-    fprintf(stderr, "depth: %d, dir: %s, alpha: %d\n", depth, dirToString(bestDir), alpha);
+inline void GameTree::updatePV(int ply, Direction dir)
+{
+    pvTable[ply][ply] = dir;
+    for (int i = ply + 1; i < pvLength[ply + 1]; ++i)
+        pvTable[ply][i] = pvTable[ply + 1][i];
+    pvLength[ply] = pvLength[ply + 1];
+}
 
-    if (alpha == -INF) {
-        fprintf(stderr, "best alpha is -Infinity, we lose no matter what...\n");
-        throw std::runtime_error("no possible moves, or all moves result in a loss");
+const std::vector<Direction> &GameTree::principalVariation() const
+{
+    return principal;
+}
+
+long GameTree::nodeCount() const
+{
+    return stats.nodes;
+}
+
+long GameTree::probeCount() const
+{
+    return stats.ttProbes;
+}
+
+long GameTree::hitCount() const
+{
+    return stats.ttHits;
+}
+
+const SearchStats &GameTree::searchStats() const
+{
+    return stats;
+}
+
+inline bool GameTree::probe(const Map &map, TranspositionTable::Entry &entry)
+{
+    ++stats.ttProbes;
+    bool collided;
+    if (!table.get(map.hash(), entry, &collided)) {
+        if (collided)
+            ++stats.ttCollisions;
+        return false;
     }
+    ++stats.ttHits;
+    return true;
+}
 
-    return bestDir;
+static bool moveBetween(position from, position to, Direction *dir)
+{
+    for (Direction d = DIR_MIN; d <= DIR_MAX; d = static_cast<Direction>(d + 1)) {
+        position next;
+        switch (d) {
+            case NORTH: next = from.north(); break;
+            case SOUTH: next = from.south(); break;
+            case WEST: next = from.west(); break;
+            default: next = from.east(); break;
+        }
+        if (next == to) {
+            *dir = d;
+            return true;
+        }
+    }
+    return false;
 }
 
-// returns true if node is NOT a terminal node (ie the tree was built)
-bool GameTree::buildTreeTwoLevels(Node *node, const Map &map)
+bool GameTree::advance(const Map &from, const Map &to)
 {
+    Direction myDir, enemyDir;
+    if (!moveBetween(from.my_pos(), to.my_pos(), &myDir) ||
+            !moveBetween(from.enemy_pos(), to.enemy_pos(), &enemyDir)) {
+        reset();
+        return false;
+    }
+
+    // the positions alone could agree on a board that isn't the same one
+    // (a new game, say)
+    Map check(from);
+    check.move(myDir, SELF);
+    check.move(enemyDir, ENEMY);
+    if (check.hash() != to.hash()) {
+        reset();
+        return false;
+    }
+
+    NodeRef next = NO_NODE;
+    Node &oldRoot = at(root);
+    for (int i = 0; i < 4 && oldRoot.children[i] && !next; ++i) {
+        const Node &mine = at(oldRoot.children[i]);
+        if (mine.dir != myDir)
+            continue;
+        for (int j = 0; j < 4 && mine.children[j]; ++j) {
+            if (at(mine.children[j]).dir == enemyDir)
+                next = mine.children[j];
+        }
+    }
+    if (!next) {
+        reset();
+        return false;
+    }
+
+    // everything but the one subtree that is still reachable goes back to
+    // be used again, which keeps the tree from growing every turn
+    for (int i = 0; i < 4 && oldRoot.children[i]; ++i) {
+        Node &mine = at(oldRoot.children[i]);
+        for (int j = 0; j < 4 && mine.children[j]; ++j) {
+            if (mine.children[j] != next) {
+                freeBelow(mine.children[j]);
+                freeNode(mine.children[j]);
+            }
+        }
+        freeNode(oldRoot.children[i]);
+    }
+    freeNode(root);
+    root = next;
+
+    pathLength = 0;
+    // the killers are kept by ply, which the new root has moved
+    killers.clear();
+    if (principal.size() >= 2 && principal[0] == myDir && principal[1] == enemyDir)
+        principal.erase(principal.begin(), principal.begin() + 2);
+    else
+        principal.clear();
+    return true;
+}
+
+Direction GameTree::firstMove() const
+{
+    const Node &n = at(root);
+    if (n.children[0])
+        return at(n.children[0]).dir;
+    return NORTH;
+}
+
+bool GameTree::predictedReply(Direction myMove, Direction *reply) const
+{
+    const Node &n = at(root);
+    for (int i = 0; i < 4 && n.children[i]; ++i) {
+        const Node &mine = at(n.children[i]);
+        if (mine.dir == myMove && mine.children[0]) {
+            *reply = at(mine.children[0]).dir;
+            return true;
+        }
+    }
+    return false;
+}
+
+// returns true if node is NOT a terminal node (ie the tree was built), or
+// false if there is no room left to build it
+bool GameTree::buildTreeTwoLevels(NodeRef ref, const Map &map)
+{
+    StatTimer timer(timed, stats.expandTicks);
     if (map.my_pos() == map.enemy_pos())
         return false;
 
-    if (time_expired)
-        throw std::runtime_error("time expired for move decision");
+    int myMoves = map.cntMoves(SELF);
+    int enemyMoves = map.cntMoves(ENEMY);
+    if (myMoves == 0 || enemyMoves == 0)
+        return false;
 
-    if (map.cntMoves(SELF) == 0 || map.cntMoves(ENEMY) == 0)
+    if (!haveRoom(myMoves + myMoves * enemyMoves))
         return false;
 
     int i = 0, j;
@@ -109,8 +504,8 @@ bool GameTree::buildTreeTwoLevels(Node *node, const Map &map)
         if (map.isWall(myDir, SELF))
             continue;
 
-        nodesAlloc.push_back(Node(myDir));
-        node->children[i] = &nodesAlloc.back();
+        NodeRef mine = newNode(myDir);
+        at(ref).children[i] = mine;
 
         j = 0;
         for (Direction enemyDir = DIR_MIN; enemyDir <= DIR_MAX;
@@ -118,8 +513,8 @@ bool GameTree::buildTreeTwoLevels(Node *node, const Map &map)
             if (map.isWall(enemyDir, ENEMY))
                 continue;
 
-            nodesAlloc.push_back(Node(enemyDir));
-            node->children[i]->children[j] = &nodesAlloc.back();
+            NodeRef reply = newNode(enemyDir);
+            at(mine).children[j] = reply;
 
             ++j;
         }
@@ -130,28 +525,68 @@ bool GameTree::buildTreeTwoLevels(Node *node, const Map &map)
     return true;
 }
 
-int GameTree::negascout(Node *node, Map &map, int depth,
+// Once the deadline passes every call returns straight away, undoing its
+// moves on the way out. The values returned then mean nothing, except at
+// the root, where alpha is still the value of the best move searched.
+int GameTree::negascout(NodeRef ref, Map &map, int depth,
         int alpha, int beta, int sign, Direction *bestDir)
 {
-    if (time_expired)
-        throw std::runtime_error("time expired for move decision");
+    int ply = pathLength;
+    pvLength[ply] = ply;
 
-    if (node->children[0] == NULL) {
-        if (!buildTreeTwoLevels(node, map)) {
+    if (deadline.expired())
+        return alpha;
+    ++stats.nodes;
+
+    // the heuristic spots the end of the game by itself, so leaves don't
+    // need their children built
+    if (depth == 0)
+        return sign * heuristic(map);
+
+    Node *node = &at(ref);
+    if (node->children[0] == NO_NODE) {
+        if (!buildTreeTwoLevels(ref, map)) {
             return sign * heuristic(map);
         }
     }
+    if (!node->ordered)
+        orderMoves(*node, map, sign);
 
-    if (depth == 0)
-        return sign * heuristic(map);
+    TranspositionTable::Entry entry;
+    if (probe(map, entry)) {
+        // the root still has to search to find the move that goes with the
+        // value
+        if (!bestDir && entry.depth >= depth) {
+            if (entry.bound == TranspositionTable::BOUND_EXACT)
+                return entry.value;
+            if (entry.bound == TranspositionTable::BOUND_LOWER && entry.value >= beta)
+                return entry.value;
+            if (entry.bound == TranspositionTable::BOUND_UPPER && entry.value <= alpha)
+                return entry.value;
+        }
 
+        // try the move that was best last time first, which matters when
+        // another thread or another path through the tree found it
+        if (entry.move != TranspositionTable::NO_MOVE) {
+            for (int i = 1; i < 4 && node->children[i]; ++i) {
+                if (at(node->children[i]).dir == entry.move) {
+                    node->promoteMove(i);
+                    break;
+                }
+            }
+        }
+    }
+
+    int origAlpha = alpha;
     int b = beta;
     for (int i = 0; i < 4 && node->children[i]; ++i) {
-        Direction dir = node->children[i]->dir;
+        Direction dir = at(node->children[i]).dir;
 
-        map.move(dir, signToPlayer(sign));
+        makeMove(map, dir, signToPlayer(sign));
         int a = -negascout(node->children[i], map, depth - 1, -b, -alpha, -sign, NULL);
-        map.unmove(dir, signToPlayer(sign));
+        unmakeMove(map, dir, signToPlayer(sign));
+        if (deadline.stopped())
+            return alpha;
 
         if (a > alpha) {
             alpha = a;
@@ -160,117 +595,189 @@ int GameTree::negascout(Node *node, Map &map, int depth,
                 *bestDir = dir;
 
             node->promoteMove(i);
+            updatePV(ply, dir);
         }
 
-        if (alpha >= beta) // beta cutoff
+        if (alpha >= beta) { // beta cutoff
+            recordCutoff(map, dir, sign, depth, i);
+            freePruned(ref, i, sign);
             break;
+        }
 
         // negascout additions start
         if (alpha >= b) { // null window check
-            map.move(dir, signToPlayer(sign));
+            ++stats.researches;
+            makeMove(map, dir, signToPlayer(sign));
             // note: to reach here we must have improved alpha, so we would have
             // promoted the child to position 0
-            alpha = -negascout(node->children[0], map, depth - 1, -beta, -alpha, -sign, NULL);
-            map.unmove(dir, signToPlayer(sign));
+            a = -negascout(node->children[0], map, depth - 1, -beta, -alpha, -sign, NULL);
+            unmakeMove(map, dir, signToPlayer(sign));
+            if (deadline.stopped())
+                return alpha;
+            alpha = a;
+            updatePV(ply, dir);
 
-            if (alpha >= beta) // beta cutoff
+            if (alpha >= beta) { // beta cutoff
+                recordCutoff(map, dir, sign, depth, i);
+                freePruned(ref, i, sign);
                 break;
+            }
         }
 
         b = alpha + 1;
         // negascout additions end
     }
 
+    TranspositionTable::Entry result;
+    result.value = alpha;
+    result.depth = depth;
+    if (alpha <= origAlpha) {
+        result.bound = TranspositionTable::BOUND_UPPER;
+    } else {
+        result.bound = alpha >= beta ?
+            TranspositionTable::BOUND_LOWER : TranspositionTable::BOUND_EXACT;
+        // whichever move raised alpha last was promoted to the front
+        result.move = at(node->children[0]).dir;
+    }
+    table.set(map.hash(), result);
+
     return alpha;
 }
 
-static void fillBoardVoronoi(std::vector<int> &board, int depth,
-        std::vector<position> &posVisits)
+// Searches whole moves at a time: each node is a position with both
+// players to move, and its children are the matrix of pairs of moves. The
+// enemy is still taken to know our move (max over our moves of the min
+// over its replies), which keeps the score a safe bound, but only the
+// positions after both have moved are evaluated or stored, and a pair of
+// moves into the same square is scored as the draw it is right there.
+// depth is in plies, two to a move, the same as negascout's, so the two
+// share what they store in the transposition table.
+int GameTree::jointSearch(NodeRef ref, Map &map, int depth,
+        int alpha, int beta, Direction *bestDir)
 {
-    std::vector<position> posVisitsOut;
-    posVisitsOut.reserve(posVisits.capacity());
+    int ply = pathLength;
+    pvLength[ply] = ply;
 
-    for (std::vector<position>::const_iterator it = posVisits.begin();
-            it != posVisits.end(); ++it) {
-        if (board[index(it->north())] > depth) {
-            board[index(it->north())] = depth;
-            posVisitsOut.push_back(it->north());
-        }
-        if (board[index(it->south())] > depth) {
-            board[index(it->south())] = depth;
-            posVisitsOut.push_back(it->south());
-        }
-        if (board[index(it->west())] > depth) {
-            board[index(it->west())] = depth;
-            posVisitsOut.push_back(it->west());
-        }
-        if (board[index(it->east())] > depth) {
-            board[index(it->east())] = depth;
-            posVisitsOut.push_back(it->east());
+    if (deadline.expired())
+        return alpha;
+    ++stats.nodes;
+
+    if (depth <= 0)
+        return heuristic(map);
+
+    Node *node = &at(ref);
+    if (node->children[0] == NO_NODE) {
+        if (!buildTreeTwoLevels(ref, map)) {
+            return heuristic(map);
         }
     }
+    if (!node->ordered)
+        orderMoves(*node, map, 1);
 
-    posVisits.swap(posVisitsOut);
-}
-
-static void setupVoronoiBoards(const Map &map,
-        std::vector<int> &boardPlayer,
-        std::vector<int> &boardEnemy)
-{
-    boardPlayer.resize(width*height);
+    TranspositionTable::Entry entry;
+    if (probe(map, entry)) {
+        if (!bestDir && entry.depth >= depth) {
+            if (entry.bound == TranspositionTable::BOUND_EXACT)
+                return entry.value;
+            if (entry.bound == TranspositionTable::BOUND_LOWER && entry.value >= beta)
+                return entry.value;
+            if (entry.bound == TranspositionTable::BOUND_UPPER && entry.value <= alpha)
+                return entry.value;
+        }
 
-    position pos;
-    for (pos.x = 0; pos.x < width; ++pos.x) {
-        for (pos.y = 0; pos.y < height; ++pos.y) {
-            boardPlayer[index(pos)] = map.isWall(pos) ? INT_MIN : INT_MAX;
+        if (entry.move != TranspositionTable::NO_MOVE) {
+            for (int i = 1; i < 4 && node->children[i]; ++i) {
+                if (at(node->children[i]).dir == entry.move) {
+                    node->promoteMove(i);
+                    break;
+                }
+            }
         }
     }
 
-    boardPlayer[index(map.my_pos())] = INT_MIN;
-    boardPlayer[index(map.enemy_pos())] = INT_MIN;
-
-    boardEnemy = boardPlayer;
-}
+    int origAlpha = alpha;
+    for (int i = 0; i < 4 && node->children[i]; ++i) {
+        Node &mine = at(node->children[i]);
+        Direction myDir = mine.dir;
+
+        makeMove(map, myDir, SELF);
+        if (!mine.ordered)
+            orderMoves(mine, map, -1);
+        pvLength[ply + 1] = ply + 1;
+
+        // the enemy's best reply; the rest can be skipped once one holds
+        // this move to alpha
+        int worst = INF;
+        for (int j = 0; j < 4 && mine.children[j]; ++j) {
+            Direction enemyDir = at(mine.children[j]).dir;
+
+            makeMove(map, enemyDir, ENEMY);
+            int v;
+            if (map.my_pos() == map.enemy_pos()) {
+                v = 0; // draw
+                pvLength[ply + 2] = ply + 2;
+            } else {
+                v = jointSearch(mine.children[j], map, depth - 2,
+                        alpha, std::min(worst, beta), NULL);
+            }
+            unmakeMove(map, enemyDir, ENEMY);
+            if (deadline.stopped()) {
+                unmakeMove(map, myDir, SELF);
+                return alpha;
+            }
+
+            if (v < worst) {
+                worst = v;
+                mine.promoteMove(j);
+                updatePV(ply + 1, enemyDir);
+            }
+
+            if (worst <= alpha) {
+                recordCutoff(map, enemyDir, -1, depth - 1, j);
+                break;
+            }
+        }
+        unmakeMove(map, myDir, SELF);
 
-static int countVoronoiBoards(const std::vector<int> &boardPlayer,
-        const std::vector<int> &boardEnemy)
-{
-    int cnt = 0;
-    for (int i = 0; i < width*height; ++i) {
-        int playerDepth = boardPlayer[i];
-        int enemyDepth = boardEnemy[i];
-        if (playerDepth < enemyDepth)
-            ++cnt;
-        else if (playerDepth > enemyDepth)
-            --cnt;
-    }
-    return cnt;
-}
+        if (worst > alpha) {
+            alpha = worst;
 
-// count of squares player can reach first minus squares enemy can reach first
-static int voronoiTerritory(const Map &map)
-{
-    std::vector<int> boardPlayer, boardEnemy;
+            if (bestDir)
+                *bestDir = myDir;
 
-    setupVoronoiBoards(map, boardPlayer, boardEnemy);
+            node->promoteMove(i);
+            updatePV(ply, myDir);
+        }
 
-    std::vector<position> posVisits;
-    posVisits.reserve(width*2 + height*2);
-    posVisits.push_back(map.my_pos());
-    for (int depth = 1; !posVisits.empty(); ++depth) {
-        fillBoardVoronoi(boardPlayer, depth, posVisits);
+        if (alpha >= beta) {
+            recordCutoff(map, myDir, 1, depth, i);
+            freePruned(ref, i, 1);
+            break;
+        }
     }
 
-    posVisits.clear();
-    posVisits.push_back(map.enemy_pos());
-    for (int depth = 1; !posVisits.empty(); ++depth) {
-        fillBoardVoronoi(boardEnemy, depth, posVisits);
+    TranspositionTable::Entry result;
+    result.value = alpha;
+    result.depth = depth;
+    if (alpha <= origAlpha) {
+        result.bound = TranspositionTable::BOUND_UPPER;
+    } else {
+        result.bound = alpha >= beta ?
+            TranspositionTable::BOUND_LOWER : TranspositionTable::BOUND_EXACT;
+        result.move = at(node->children[0]).dir;
     }
+    table.set(map.hash(), result);
+
+    return alpha;
+}
 
-    return countVoronoiBoards(boardPlayer, boardEnemy);
+// count of squares player can reach first minus squares enemy can reach first
+static int voronoiTerritory(const Map &map, bool *connected = NULL)
+{
+    return bbVoronoi(map.getBoard(), map.my_pos(), map.enemy_pos(), connected);
 }
 
-static bool fillBoardDistanceToOpponent(std::vector<bool> &board,
+static bool fillBoardDistanceToOpponent(Bitboard &board,
         std::vector<position> &posVisits, position opp_pos)
 {
     std::vector<position> posVisitsOut;
@@ -281,20 +788,20 @@ static bool fillBoardDistanceToOpponent(std::vector<bool> &board,
         if (*it == opp_pos)
             return true;
 
-        if (!board[index(it->north())]) {
-            board[index(it->north())] = true;
+        if (!board.get(it->north())) {
+            board.set(it->north());
             posVisitsOut.push_back(it->north());
         }
-        if (!board[index(it->south())]) {
-            board[index(it->south())] = true;
+        if (!board.get(it->south())) {
+            board.set(it->south());
             posVisitsOut.push_back(it->south());
         }
-        if (!board[index(it->west())]) {
-            board[index(it->west())] = true;
+        if (!board.get(it->west())) {
+            board.set(it->west());
             posVisitsOut.push_back(it->west());
         }
-        if (!board[index(it->east())]) {
-            board[index(it->east())] = true;
+        if (!board.get(it->east())) {
+            board.set(it->east());
             posVisitsOut.push_back(it->east());
         }
     }
@@ -303,14 +810,14 @@ static bool fillBoardDistanceToOpponent(std::vector<bool> &board,
     return false;
 }
 
-static int distanceToOpponent(const Map &map)
+int distanceToOpponent(const Map &map)
 {
-    std::vector<bool> board(map.getBoard());
-    board[index(map.my_pos())] = false;
-    board[index(map.enemy_pos())] = false;
+    Bitboard board(map.getBoard());
+    board.reset(map.my_pos());
+    board.reset(map.enemy_pos());
 
     std::vector<position> posVisits;
-    posVisits.reserve(width*2 + height*2);
+    posVisits.reserve(map.width()*2 + map.height()*2);
     posVisits.push_back(map.my_pos());
     for (int depth = 0; !posVisits.empty(); ++depth) {
         if (fillBoardDistanceToOpponent(board, posVisits, map.enemy_pos())) {
@@ -322,15 +829,15 @@ static int distanceToOpponent(const Map &map)
 
 static int countCorridorSquares(const Map &map)
 {
-    std::vector<bool> board(map.getBoard());
+    Bitboard board(map.getBoard());
     fillUnreachableSquares(board, map.my_pos());
 
     int cnt = 0;
 
     position pos;
-    for (pos.x = 0; pos.x < width; ++pos.x) {
-        for (pos.y = 0; pos.y < height; ++pos.y) {
-            if (board[index(pos)])
+    for (pos.x = 0; pos.x < map.width(); ++pos.x) {
+        for (pos.y = 0; pos.y < map.height(); ++pos.y) {
+            if (board.get(pos))
                 continue;
 
             if (isCorridorSquare(board, pos))
@@ -340,7 +847,7 @@ static int countCorridorSquares(const Map &map)
     return cnt;
 }
 
-static int heuristic(const Map &map)
+int GameTree::heuristic(const Map &map)
 {
     if (map.my_pos() == map.enemy_pos())
         return 0; // draw
@@ -359,41 +866,204 @@ static int heuristic(const Map &map)
     // space in the transposition table for them
 
     {
-        const TranspositionTable::Entry *entry = trans_table.get(map.hash());
-        if (entry)
-            return entry->heuristic;
+        TranspositionTable::Entry entry;
+        if (probe(map, entry) &&
+                entry.heuristic != TranspositionTable::NO_HEURISTIC)
+            return entry.heuristic;
     }
 
+    ++stats.leafEvals;
+    StatTimer timer(timed, stats.heuristicTicks);
+
+    // the territory fill finds out whether the players are connected on
+    // the way, so there's no need for a separate flood fill
     int ret;
-    if (isOpponentIsolated(map)) {
-        int cntPlayer = countReachableSquares(map, SELF);
-        int cntEnemy = countReachableSquares(map, ENEMY);
-        ret = cntPlayer - cntEnemy;
-    } else {
-        int voronoi = voronoiTerritory(map);
-        ret = voronoi;
+    {
+        StatTimer fillTimer(timed, stats.fillTicks);
+        bool connected;
+        if (incremental) {
+            for (; territoryPly < pathLength; ++territoryPly) {
+                territory.move(path[territoryPly].player,
+                        path[territoryPly].to);
+            }
+            ret = territory.score(&connected);
+        } else {
+            ret = voronoiTerritory(map, &connected);
+        }
+        if (!connected) {
+            ret = countReachableSquares(map, SELF) -
+                countReachableSquares(map, ENEMY);
+        }
     }
 
     TranspositionTable::Entry entry;
     entry.heuristic = ret;
 
-    trans_table.set(map.hash(), entry);
+    table.set(map.hash(), entry);
     return ret;
 }
 
-Direction decideMoveMinimax(Map map)
+struct HelperSearch
 {
-    GameTree tree;
+    SearchContext *context;
+    const Map *map;
+    int startDepth;
+    SearchStats *stats; // one for each helper
+};
+
+// Lazy SMP: each helper runs its own iterative deepening over its own copy
+// of the map and its own tree, and all the threads share is the
+// transposition table. Every other helper starts a step deeper than the
+// main search, so the threads spread out over the depths instead of
+// searching the same tree in lockstep.
+static void helperSearch(void *arg, int helper)
+{
+    const HelperSearch &search = *static_cast<HelperSearch *>(arg);
+    SearchContext &context = *search.context;
+    Map map(*search.map);
+    GameTree &tree = *context.helperTrees[helper];
+    tree.newGame();
+    Direction dir;
+
+    int depth = search.startDepth + (helper % 2 == 0 ? 2 : 0);
+    for (; depth < 100; depth += 2) {
+        bool carryOn = tree.decideMove(map, depth, &dir);
+        search.stats[helper].add(tree.searchStats());
+        if (!carryOn)
+            break;
+    }
+}
 
-    Direction dir = NORTH;
-    try {
-        for (int depth = 2; depth < 100; depth += 2) { // fixme
-            dir = tree.decideMove(map, depth);
-            fprintf(stderr, "Depth %d ==> %s\n", depth, dirToString(dir));
+// The main search's tree is kept from one turn to the next, along with the
+// position it was last searched from and how deep it got. When the new
+// position is a move on from that one the tree is re-rooted rather than
+// rebuilt, and since the transposition table still holds last turn's
+// results the shallow depths come back almost for free, so the deepening
+// starts a full move short of where it got to last time.
+Direction decideMoveMinimax(Map map, SearchContext &context,
+        ThreadPool &helpers)
+{
+    GameTree &searchTree = context.tree;
+
+    int startDepth = 2;
+    if (!context.searchedBefore)
+        context.searchedBefore = true;
+    else if (map.hash() == context.treeMap.hash()) // pondered on this very position
+        startDepth = std::max(2, context.treeDepth);
+    else if (searchTree.advance(context.treeMap, map))
+        startDepth = std::max(2, context.treeDepth - 2);
+    context.treeMap = map;
+    context.treeDepth = 0;
+
+    // nothing to think about with only one move (or none)
+    if (map.cntMoves(SELF) <= 1) {
+        context.treeDepth = startDepth;
+        for (Direction dir = DIR_MIN; dir <= DIR_MAX;
+                dir = static_cast<Direction>(dir + 1)) {
+            if (!map.isWall(dir, SELF))
+                return dir;
         }
-    } catch (...) {
+        return NORTH;
+    }
+
+    // Neither player can make more moves than their fill, and the game is
+    // over once either runs out, so searching past this many plies finds
+    // nothing new.
+    int maxDepth = 2 * (std::min(countReachableSquares(map, SELF),
+                countReachableSquares(map, ENEMY)) + 1);
+
+    // the main search moves around in map, so the helpers get a copy that
+    // stays put until they are done
+    const Map rootMap(map);
+    std::vector<SearchStats> helperStats(helpers.size());
+    while (context.helperTrees.size() < helperStats.size()) {
+        context.helperTrees.push_back(new GameTree(context.table,
+                    context.deadline, context.options, false));
+    }
+    HelperSearch helperArg = {&context, &rootMap, startDepth,
+        helperStats.empty() ? NULL : &helperStats[0]};
+    context.table.newSearch();
+    helpers.start(&helperSearch, &helperArg);
+
+    // if even the first depth doesn't get through a move, the best move
+    // from last turn's search is better than nothing
+    Direction dir = searchTree.firstMove();
+    for (int depth = startDepth; depth < 100 && depth <= maxDepth; depth += 2) {
+        if (depth > startDepth && !context.time.startNextDepth())
+            break;
+        bool carryOn = searchTree.decideMove(map, depth, &dir);
+        context.turnStats.add(searchTree.searchStats());
+        if (!carryOn)
+            break;
+        context.treeDepth = depth;
+        context.time.depthDone(dir, searchTree.nodeCount());
+        fprintf(stderr, "Depth %d ==> %s\n", depth, dirToString(dir));
     }
 
+    // the move is decided, so stop the helpers too
+    context.deadline.stop();
+    helpers.wait();
+    for (size_t i = 0; i < helperStats.size(); ++i)
+        context.turnStats.add(helperStats[i]);
+
     return dir;
 }
 
+static void ponderSearch(void *arg, int)
+{
+    SearchContext &context = *static_cast<SearchContext *>(arg);
+    Direction dir;
+
+    for (int depth = context.ponderDepth; depth < 100; depth += 2) {
+        if (!context.tree.decideMove(context.ponderMap, depth, &dir))
+            break;
+        context.treeDepth = depth;
+    }
+}
+
+// The main search's tree is moved on to the position after our move and the
+// reply it expects, and searched there while the enemy thinks. If the enemy
+// does reply that way the next turn carries on from wherever the pondering
+// got to; if not, the tree starts over, but whatever the pondering shares
+// with the real position is still in the transposition table.
+bool startPondering(const Map &map, Direction myMove, SearchContext &context,
+        ThreadPool &ponderer)
+{
+    // only the minimax search leaves a tree behind for this position
+    if (ponderer.size() == 0 || !context.searchedBefore ||
+            map.hash() != context.treeMap.hash())
+        return false;
+
+    Direction reply;
+    if (!context.tree.predictedReply(myMove, &reply))
+        return false;
+
+    Map next(map);
+    next.move(myMove, SELF);
+    if (next.isWall(reply, ENEMY))
+        return false;
+    next.move(reply, ENEMY);
+
+    bool advanced = context.tree.advance(context.treeMap, next);
+    context.treeMap = next;
+    if (!advanced) {
+        context.treeDepth = 0;
+        return false;
+    }
+
+    // the tree and table from this turn make the first depth cheap, so
+    // the next turn can start there even if pondering gets no further
+    context.ponderMap = next;
+    context.ponderDepth = std::max(2, context.treeDepth - 2);
+    context.treeDepth = context.ponderDepth;
+
+    context.deadline.startUnlimited();
+    ponderer.start(&ponderSearch, &context);
+    return true;
+}
+
+void stopPondering(SearchContext &context, ThreadPool &ponderer)
+{
+    context.deadline.stop();
+    ponderer.wait();
+}
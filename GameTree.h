@@ -0,0 +1,187 @@
+#ifndef GAME_TREE_H
+#define GAME_TREE_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "Map.h"
+#include "MoveDeciders.h"
+#include "Telemetry.h"
+#include "Voronoi.h"
+
+class Deadline;
+
+// deeper than any search goes
+const int MAX_PLY = 128;
+
+// The minimax search: negascout over a tree of nodes that is kept between
+// searches, so each deepening step (and each turn, through advance()) only
+// builds what the last one didn't.
+class GameTree
+{
+    public:
+        // The tree searches with the given table and stops when deadline
+        // does; both are shared with the other threads searching the same
+        // position.
+        GameTree(TranspositionTable &table, Deadline &deadline,
+                const SearchOptions &options, bool verbose = true);
+        ~GameTree();
+
+        // Searches depth plies deep, returning false if the search was
+        // stopped or found that every move loses. *dir is set to the best
+        // move found; for a search that was stopped that is the best of the
+        // moves it got through, and it is left alone if there were none.
+        bool decideMove(Map &map, int depth, Direction *dir);
+
+        // nodes visited by the last decideMove
+        long nodeCount() const;
+
+        // transposition table lookups made by the last decideMove, and how
+        // many of them found an entry
+        long probeCount() const;
+        long hitCount() const;
+
+        // everything the last decideMove counted; the times are only kept
+        // if options.telemetryPath is set
+        const SearchStats &searchStats() const;
+
+        // the line of play the last finished search expects, starting
+        // with the move it picked
+        const std::vector<Direction> &principalVariation() const;
+
+        // Moves the root down to the grandchild for the moves that take
+        // from to to, keeping everything searched below it. If to isn't one
+        // full move on from from, or that part of the tree was never built,
+        // the tree starts over and false is returned.
+        bool advance(const Map &from, const Map &to);
+
+        // the first move at the root, which is the best one found so far
+        // (NORTH if the root hasn't been searched)
+        Direction firstMove() const;
+
+        // the enemy's best reply to myMove at the root as of the last
+        // search, if it got that far
+        bool predictedReply(Direction myMove, Direction *reply) const;
+
+        // throws away the tree and everything learned about move ordering,
+        // for a new game
+        void newGame();
+
+    private:
+        typedef uint32_t NodeRef;
+        static const NodeRef NO_NODE = 0;
+
+        void reset();
+        bool buildTreeTwoLevels(NodeRef ref, const Map &map);
+        int negascout(NodeRef ref, Map &map, int depth,
+                int alpha, int beta, int sign, Direction *dir);
+        int jointSearch(NodeRef ref, Map &map, int depth,
+                int alpha, int beta, Direction *dir);
+
+        // make and unmake a move, keeping count of how far the search is
+        // from the root
+        void makeMove(Map &map, Direction dir, Player p);
+        void unmakeMove(Map &map, Direction dir, Player p);
+
+        int heuristic(const Map &map);
+
+        // moves made since the root on the current search path
+        int pathLength;
+
+        // The territory, if options.incrementalTerritory is set, which has
+        // had the first territoryPly moves of the path made on it. Moves are
+        // only made on it when a leaf needs them, so leaves that come from
+        // the table or end the game cost nothing.
+        bool incremental;
+        IncrementalVoronoi territory;
+        int territoryPly;
+        struct PathMove
+        {
+            int player;
+            position to;
+        };
+        PathMove path[MAX_PLY];
+
+        TranspositionTable &table;
+        Deadline &deadline;
+
+        // see SearchOptions
+        int aspirationWindow;
+        int aspirationGrowth;
+        bool jointMoves;
+
+        bool verbose;
+        bool timed;
+        SearchStats stats;
+
+        bool probe(const Map &map, TranspositionTable::Entry &entry);
+
+        // the score of the last finished search, which the next one centres
+        // its aspiration window on
+        int lastScore;
+        bool haveScore;
+
+        // Triangular array of the best line found below each ply of the
+        // current search: pvTable[ply][ply..pvLength[ply]). The line from
+        // the last finished search is kept in principal, and is walked
+        // first by the next one.
+        Direction pvTable[MAX_PLY][MAX_PLY];
+        int pvLength[MAX_PLY];
+        std::vector<Direction> principal;
+
+        void updatePV(int ply, Direction dir);
+        void followPV();
+        int searchRoot(Map &map, int depth, int alpha, int beta,
+                Direction *dir, bool *found);
+
+        struct Node
+        {
+            NodeRef children[4];
+            Direction dir;
+            bool ordered; // children sorted by orderMoves yet
+
+            void promoteMove(int i);
+        };
+
+        // Moves are ordered the first time a node is searched by the
+        // killer moves for its ply (the last two moves to cause a cutoff
+        // there), then by a history of how much cutoff searching each move
+        // from each square has saved.
+        struct Killers
+        {
+            int moves[2]; // Directions, or NO_KILLER
+        };
+        static const int NO_KILLER = -1;
+
+        std::vector<Killers> killers;
+        std::vector<long> history;
+
+        size_t historyIndex(const Map &map, Player p, Direction dir) const;
+        void orderMoves(Node &n, const Map &map, int sign);
+        // i is where dir was in the node's order when it was tried
+        void recordCutoff(const Map &map, Direction dir, int sign, int depth,
+                int i);
+
+        // The nodes live in one block that is reserved up front, so they
+        // never move and can refer to each other by index. Index 0 is never
+        // handed out, which lets NO_NODE be 0. Freed nodes are chained
+        // through children[0] and handed out again before the block grows.
+        std::vector<Node> nodes;
+        NodeRef freeList;
+        size_t freeCount;
+        size_t maxNodes;
+
+        NodeRef root;
+
+        Node &at(NodeRef ref);
+        const Node &at(NodeRef ref) const;
+        bool haveRoom(size_t count) const;
+        NodeRef newNode(Direction dir);
+        void freeNode(NodeRef ref);
+        // frees everything below a node where SELF is to move
+        void freeBelow(NodeRef ref);
+        // frees what was found below the moves after the cutoff at i
+        void freePruned(NodeRef ref, int i, int sign);
+};
+
+#endif
@@ -1,13 +1,13 @@
 #include "Map.h"
 #include <cstdio>
 #include <cstdlib>
+#include <climits>
 #include <string>
 #include <vector>
 
 #include <unistd.h>
 #include <fcntl.h>
-
-int width, height;
+#include <sys/mman.h>
 
 const char *dirToString(Direction dir)
 {
@@ -30,14 +30,23 @@ const char *playerToString(Player p)
 }
 
 
-std::vector<HASH_TYPE> wall_hashes;
-std::vector<HASH_TYPE> player_hashes[2];
+Zobrist::Zobrist() :
+    w(0), h(0)
+{
+}
+
+void Zobrist::resize(int width, int height)
+{
+    w = width;
+    h = height;
+    walls.resize(width*height);
+    players[0].resize(width*height);
+    players[1].resize(width*height);
+}
 
-void zobrist_init()
+void Zobrist::init(int width, int height)
 {
-    wall_hashes.resize(width*height);
-    player_hashes[0].resize(width*height);
-    player_hashes[1].resize(width*height);
+    resize(width, height);
 
     int fd = open("/dev/urandom", O_RDONLY);
 
@@ -46,29 +55,273 @@ void zobrist_init()
         exit(1);
     }
 
-    read(fd, &wall_hashes.front(), width*height*sizeof(HASH_TYPE));
-    read(fd, &player_hashes[0].front(), width*height*sizeof(HASH_TYPE));
-    read(fd, &player_hashes[1].front(), width*height*sizeof(HASH_TYPE));
+    read(fd, &walls.front(), width*height*sizeof(HASH_TYPE));
+    read(fd, &players[0].front(), width*height*sizeof(HASH_TYPE));
+    read(fd, &players[1].front(), width*height*sizeof(HASH_TYPE));
 
     close(fd);
 }
 
-TranspositionTable trans_table;
+// splitmix64
+static inline uint64_t nextKey(uint64_t &state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void Zobrist::init(int width, int height, uint64_t seed)
+{
+    resize(width, height);
+
+    for (size_t i = 0; i < walls.size(); ++i)
+        walls[i] = nextKey(seed);
+    for (size_t i = 0; i < players[0].size(); ++i)
+        players[0][i] = nextKey(seed);
+    for (size_t i = 0; i < players[1].size(); ++i)
+        players[1][i] = nextKey(seed);
+}
+
+// Entries are packed into one word: value and heuristic take 24 bits each,
+// then 7 bits of depth, 2 of bound, 3 of move (plus one) and 4 of age.
+// Searches never get anywhere near those depths, and apart from the
+// infinities every value is bounded by the number of squares.
+static const int VALUE_INF = (1 << 23) - 1;
+
+static inline uint64_t packValue(int value)
+{
+    if (value >= VALUE_INF)
+        value = VALUE_INF;
+    else if (value <= -VALUE_INF)
+        value = -VALUE_INF;
+    return uint64_t(value) & 0xffffff;
+}
+
+static inline int unpackValue(uint64_t bits)
+{
+    int value = int32_t(uint32_t(bits & 0xffffff) << 8) >> 8;
+    if (value == VALUE_INF)
+        return INT_MAX;
+    else if (value == -VALUE_INF)
+        return -INT_MAX;
+    return value;
+}
+
+TranspositionTable::Entry::Entry() :
+    heuristic(NO_HEURISTIC), value(0), depth(0), bound(BOUND_NONE),
+    move(NO_MOVE), age(0)
+{
+}
+
+TranspositionTable::TranspositionTable() :
+    buckets(NULL), mask(0), mapping(NULL), mappingSize(0), age(0),
+    prefaulted(false)
+{
+    resize(TRANSPOSITION_TABLE_SIZE, false);
+}
+
+TranspositionTable::~TranspositionTable()
+{
+    munmap(mapping, mappingSize);
+}
+
+static void touchPages(void *start, size_t bytes)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < bytes; i += page)
+        static_cast<volatile char *>(start)[i] = 0;
+}
+
+void TranspositionTable::resize(size_t entries, bool prefault)
+{
+    // transparent huge pages only back whole, aligned 2M ranges
+    const size_t hugePage = 2 * 1024 * 1024;
+
+    size_t count = 1;
+    while (count * 2 * BUCKET_SLOTS <= entries)
+        count *= 2;
+
+    if (mapping)
+        munmap(mapping, mappingSize);
+
+    size_t bytes = count * sizeof(Bucket);
+    mappingSize = bytes + hugePage;
+    mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        perror("failed to map the transposition table");
+        exit(1);
+    }
+
+    uintptr_t start = (uintptr_t(mapping) + hugePage - 1) & ~uintptr_t(hugePage - 1);
+    buckets = reinterpret_cast<Bucket *>(start);
+    mask = count - 1;
+
+#ifdef MADV_HUGEPAGE
+    // only a hint, the table works the same without them
+    madvise(buckets, bytes, MADV_HUGEPAGE);
+#endif
+
+    // fresh anonymous pages are zero, which is what an empty slot looks like
+    prefaulted = prefault;
+    if (prefault)
+        touchPages(buckets, bytes);
+    age = 0;
+}
+
+void TranspositionTable::clear()
+{
+    // pages handed back come back zero the next time they are touched
+    size_t bytes = (mask + 1) * sizeof(Bucket);
+    madvise(buckets, bytes, MADV_DONTNEED);
+    if (prefaulted)
+        touchPages(buckets, bytes);
+    age = 0;
+}
+
+uint64_t TranspositionTable::pack(const Entry &entry)
+{
+    return packValue(entry.value) |
+        (uint64_t(entry.heuristic) & 0xffffff) << 24 |
+        uint64_t(entry.depth & 0x7f) << 48 |
+        uint64_t(entry.bound) << 55 |
+        uint64_t(entry.move + 1) << 57 |
+        uint64_t(entry.age & 0xf) << 60;
+}
+
+TranspositionTable::Entry TranspositionTable::unpack(uint64_t data)
+{
+    Entry entry;
+    entry.value = unpackValue(data);
+    entry.heuristic = int32_t(uint32_t(data >> 24 & 0xffffff) << 8) >> 8;
+    entry.depth = data >> 48 & 0x7f;
+    entry.bound = static_cast<Bound>(data >> 55 & 3);
+    entry.move = int(data >> 57 & 7) - 1;
+    entry.age = data >> 60;
+    return entry;
+}
+
+inline TranspositionTable::Bucket &TranspositionTable::bucketFor(HASH_TYPE hash)
+{
+    return buckets[hash & mask];
+}
+
+inline const TranspositionTable::Bucket &TranspositionTable::bucketFor(HASH_TYPE hash) const
+{
+    return buckets[hash & mask];
+}
 
-const TranspositionTable::Entry *TranspositionTable::get(HASH_TYPE hash)
+bool TranspositionTable::get(HASH_TYPE hash, Entry &entry,
+        bool *collided) const
 {
-    if (data[hash % TRANSPOSITION_TABLE_SIZE].first == hash)
-        return &data[hash % TRANSPOSITION_TABLE_SIZE].second;
-    else
-        return NULL;
+    const Bucket &bucket = bucketFor(hash);
+
+    bool full = true;
+    for (int i = 0; i < BUCKET_SLOTS; ++i) {
+        const Slot &slot = bucket.slots[i];
+        uint64_t check = __atomic_load_n(&slot.check, __ATOMIC_RELAXED);
+        uint64_t d = __atomic_load_n(&slot.data, __ATOMIC_RELAXED);
+
+        if ((check ^ d) == hash) {
+            entry = unpack(d);
+            return true;
+        }
+        if (check == 0 && d == 0)
+            full = false;
+    }
+
+    if (collided)
+        *collided = full;
+    return false;
 }
 
 void TranspositionTable::set(HASH_TYPE hash, const Entry &entry)
 {
-    data[hash % TRANSPOSITION_TABLE_SIZE].first = hash;
-    data[hash % TRANSPOSITION_TABLE_SIZE].second = entry;
+    Bucket &bucket = bucketFor(hash);
+    Entry merged = entry;
+    merged.age = age;
+
+    Slot *victim = NULL;
+    int victimScore = INT_MAX;
+    for (int i = 0; i < BUCKET_SLOTS; ++i) {
+        Slot &slot = bucket.slots[i];
+        uint64_t check = __atomic_load_n(&slot.check, __ATOMIC_RELAXED);
+        uint64_t d = __atomic_load_n(&slot.data, __ATOMIC_RELAXED);
+
+        if ((check ^ d) == hash) {
+            // a deeper search of the same position from this turn is worth
+            // more than a shallower one, unless the shallower one is exact,
+            // and a bound is worth less than an exact result as deep
+            Entry old = unpack(d);
+            bool keepOld = merged.bound != BOUND_EXACT &&
+                old.age == (age & 0xf) &&
+                (old.depth > merged.depth ||
+                 (old.depth == merged.depth && old.bound == BOUND_EXACT));
+            if (merged.bound == BOUND_NONE ||
+                    (old.bound != BOUND_NONE && keepOld)) {
+                if (merged.heuristic != NO_HEURISTIC)
+                    old.heuristic = merged.heuristic;
+                merged = old;
+                merged.age = age;
+            } else {
+                if (merged.heuristic == NO_HEURISTIC)
+                    merged.heuristic = old.heuristic;
+                if (merged.move == NO_MOVE)
+                    merged.move = old.move;
+            }
+            victim = &slot;
+            break;
+        }
+
+        // empty slots go first, then anything from an earlier turn, and
+        // then the shallowest search
+        int score;
+        if (check == 0 && d == 0)
+            score = -1;
+        else {
+            Entry old = unpack(d);
+            score = old.depth;
+            if (old.age == (age & 0xf))
+                score += 0x80;
+        }
+        if (score < victimScore) {
+            victimScore = score;
+            victim = &slot;
+        }
+    }
+
+    uint64_t d = pack(merged);
+    __atomic_store_n(&victim->check, hash ^ d, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->data, d, __ATOMIC_RELAXED);
+}
+
+void TranspositionTable::newSearch()
+{
+    ++age;
+}
+
+
+Map::Map() :
+    zobrist(NULL), current_hash(0)
+{
 }
 
+void Map::setZobrist(const Zobrist *keys)
+{
+    zobrist = keys;
+    current_hash = 0;
+
+    position pos;
+    for (pos.y = 0; pos.y < height(); ++pos.y) {
+        for (pos.x = 0; pos.x < width(); ++pos.x) {
+            if (isWall(pos))
+                current_hash ^= keys->wall(pos);
+        }
+    }
+    current_hash ^= keys->player(SELF, player_pos[0]);
+    current_hash ^= keys->player(ENEMY, player_pos[1]);
+}
 
 void Map::move(Direction dir, Player p)
 {
@@ -86,16 +339,16 @@ void Map::move(Direction dir, Player p)
         case EAST: nextpos = currpos.east(); break;
     }
 
-    is_wall[index(nextpos)] = true;
+    is_wall.set(nextpos);
 
     switch (p) {
         case SELF: player_pos[0] = nextpos; break;
         case ENEMY: player_pos[1] = nextpos; break;
     }
 
-    current_hash ^= player_hashes[p][index(currpos)];
-    current_hash ^= player_hashes[p][index(nextpos)];
-    current_hash ^= wall_hashes[index(nextpos)];
+    current_hash ^= zobrist->player(p, currpos);
+    current_hash ^= zobrist->player(p, nextpos);
+    current_hash ^= zobrist->wall(nextpos);
 }
 
 void Map::unmove(Direction dir, Player p)
@@ -115,25 +368,28 @@ void Map::unmove(Direction dir, Player p)
         case EAST: nextpos = currpos.west(); break;
     }
 
-    is_wall[index(currpos)] = false;
+    // if both players moved into the same square, the other one is still
+    // standing on it
+    if (player_pos[0] != player_pos[1])
+        is_wall.reset(currpos);
 
     switch (p) {
         case SELF: player_pos[0] = nextpos; break;
         case ENEMY: player_pos[1] = nextpos; break;
     }
 
-    current_hash ^= player_hashes[p][index(currpos)];
-    current_hash ^= player_hashes[p][index(nextpos)];
-    current_hash ^= wall_hashes[index(currpos)];
+    current_hash ^= zobrist->player(p, currpos);
+    current_hash ^= zobrist->player(p, nextpos);
+    current_hash ^= zobrist->wall(currpos);
 }
 
 
 void Map::print(FILE *fp) const
 {
     position pos;
-    fprintf(stderr, "%d %d\n", width, height);
-    for (pos.y = 0; pos.y < height; ++pos.y) {
-        for (pos.x = 0; pos.x < width; ++pos.x) {
+    fprintf(stderr, "%d %d\n", width(), height());
+    for (pos.y = 0; pos.y < height(); ++pos.y) {
+        for (pos.x = 0; pos.x < width(); ++pos.x) {
             if (pos == player_pos[0])
                 fprintf(fp, "1");
             else if (pos == player_pos[1])
@@ -150,21 +406,17 @@ void Map::print(FILE *fp) const
 
 bool Map::readFromFile(FILE *file_handle)
 {
-    int c;
+    int c, width, height;
     int num_items = fscanf(file_handle, "%d %d\n", &width, &height);
     if (feof(file_handle) || num_items < 2) {
         return false;
     }
 
-    static bool first_time = true;
-    if (first_time) {
-        zobrist_init();
-        first_time = false;
-    }
-
+    zobrist = NULL;
     current_hash = 0;
 
-    is_wall = std::vector<bool>(width*height, false);
+    is_wall = Bitboard(width, height);
+    is_wall.setBorder();
     position pos(0, 0);
     while (pos.y < height && (c = fgetc(file_handle)) != EOF) {
         switch (c) {
@@ -183,8 +435,7 @@ bool Map::readFromFile(FILE *file_handle)
                     fprintf(stderr, "x >= width in Board_ReadFromStream\n");
                     return false;
                 }
-                is_wall[index(pos)] = true;
-                current_hash ^= wall_hashes[index(pos)];
+                is_wall.set(pos);
                 ++pos.x;
                 break;
             case ' ':
@@ -192,7 +443,7 @@ bool Map::readFromFile(FILE *file_handle)
                     fprintf(stderr, "x >= width in Board_ReadFromStream\n");
                     return false;
                 }
-                is_wall[index(pos)] = false;
+                is_wall.reset(pos);
                 ++pos.x;
                 break;
             case '1':
@@ -200,10 +451,8 @@ bool Map::readFromFile(FILE *file_handle)
                     fprintf(stderr, "x >= width in Board_ReadFromStream\n");
                     return false;
                 }
-                is_wall[index(pos)] = true;
+                is_wall.set(pos);
                 player_pos[0] = pos;
-                current_hash ^= wall_hashes[index(pos)];
-                current_hash ^= player_hashes[0][index(pos)];
                 ++pos.x;
                 break;
             case '2':
@@ -211,10 +460,8 @@ bool Map::readFromFile(FILE *file_handle)
                     fprintf(stderr, "x >= width in Board_ReadFromStream\n");
                     return false;
                 }
-                is_wall[index(pos)] = true;
+                is_wall.set(pos);
                 player_pos[1] = pos;
-                current_hash ^= wall_hashes[index(pos)];
-                current_hash ^= player_hashes[1][index(pos)];
                 ++pos.x;
                 break;
             default:
@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 #include "position.h"
+#include "Bitboard.h"
 
 enum Direction
 {
@@ -28,39 +29,172 @@ enum Player
 
 const char *playerToString(Player p);
 
-extern int width, height; // width and height never change, so why bother passing them around
+typedef uint64_t HASH_TYPE;
+
+// The random numbers that are xor'd together into Map::hash(): one for
+// each square being a wall, and one for each player being on it. Every map
+// hashed with the same keys can share a transposition table, so each game
+// has its own, sized to its board.
+class Zobrist
+{
+    public:
+        Zobrist();
+
+        // draws new keys for a board of the given size
+        void init(int width, int height);
+
+        // makes the keys from seed instead, so that hashes (and so
+        // transposition table collisions) are the same on every run
+        void init(int width, int height, uint64_t seed);
+
+        int width() const;
+        int height() const;
+
+        HASH_TYPE wall(position pos) const;
+        HASH_TYPE player(Player p, position pos) const;
+
+    private:
+        int index(position pos) const;
+        void resize(int width, int height);
+
+        int w, h;
+        std::vector<HASH_TYPE> walls;
+        std::vector<HASH_TYPE> players[2];
+};
 
 inline
-int index(position p)
+int Zobrist::width() const
 {
-    return p.x * height + p.y;
+    return w;
 }
 
-void zobrist_init();
-typedef uint64_t HASH_TYPE;
+inline
+int Zobrist::height() const
+{
+    return h;
+}
+
+inline
+int Zobrist::index(position pos) const
+{
+    return pos.x * h + pos.y;
+}
+
+inline
+HASH_TYPE Zobrist::wall(position pos) const
+{
+    return walls[index(pos)];
+}
+
+inline
+HASH_TYPE Zobrist::player(Player p, position pos) const
+{
+    return players[p][index(pos)];
+}
 
+// default number of entries, until resize() is called
 const int TRANSPOSITION_TABLE_SIZE = 1 * 1024 * 1024;
 
+// Shared by every search thread without locking. Each slot stores its key
+// xor'd with its data, so a slot torn by two threads writing at once fails
+// the key check instead of handing back half of someone else's entry.
+//
+// An entry holds both the heuristic value of a position and what the last
+// search of it found. Slots come in buckets of four sharing a cache line;
+// a new position replaces the shallowest entry in its bucket, preferring
+// ones left over from earlier turns.
 class TranspositionTable
 {
     public:
+        enum Bound
+        {
+            BOUND_NONE, // only the heuristic is known
+            BOUND_UPPER,
+            BOUND_LOWER,
+            BOUND_EXACT
+        };
+
         struct Entry
         {
-            int heuristic;
+            int heuristic; // NO_HEURISTIC if not known
+            int value; // for the player to move
+            int depth; // up to MAX_DEPTH; the more, the longer it is kept
+            Bound bound;
+            int move; // a Direction, or NO_MOVE
+            int age;
+
+            Entry();
         };
 
-        const Entry *get(HASH_TYPE hash);
+        static const int NO_HEURISTIC = -(1 << 23);
+        static const int NO_MOVE = -1;
+        static const int MAX_DEPTH = 0x7f;
+
+        TranspositionTable();
+        ~TranspositionTable();
+
+        // Throws away every entry and makes room for the given number of
+        // entries, rounded down to a power of two. The memory is mapped on
+        // its own and asked to use huge pages, since probes land all over
+        // it. If prefault is set every page is touched now rather than on
+        // the first probe to land there, which keeps the faults out of the
+        // first move's time.
+        void resize(size_t entries, bool prefault);
+
+        // throws away every entry, keeping the size
+        void clear();
+
+        // Copies out the entry for hash, returning false if there isn't
+        // one. If collided is given it is set on a miss where every slot in
+        // the bucket held another position, which is where an entry for
+        // hash may have been pushed out.
+        bool get(HASH_TYPE hash, Entry &entry, bool *collided = NULL) const;
+
+        // Adds what the entry knows to whatever is stored for hash already:
+        // a heuristic only entry doesn't throw away a search result, a bound
+        // doesn't throw away an exact result at least as deep, and a search
+        // result keeps the heuristic and best move if it lacks them.
         void set(HASH_TYPE, const Entry &entry);
 
+        // ages every entry by a turn
+        void newSearch();
+
     private:
-        std::pair<HASH_TYPE, Entry> data[TRANSPOSITION_TABLE_SIZE];
-};
+        struct Slot
+        {
+            uint64_t check;
+            uint64_t data;
+        };
+
+        enum { BUCKET_SLOTS = 4 };
+
+        struct Bucket
+        {
+            Slot slots[BUCKET_SLOTS];
+        } __attribute__((aligned(64)));
 
-extern TranspositionTable trans_table;
+        static uint64_t pack(const Entry &entry);
+        static Entry unpack(uint64_t data);
+
+        Bucket &bucketFor(HASH_TYPE hash);
+        const Bucket &bucketFor(HASH_TYPE hash) const;
+
+        Bucket *buckets;
+        size_t mask; // buckets - 1
+        void *mapping;
+        size_t mappingSize;
+        int age;
+        bool prefaulted;
+
+        TranspositionTable(const TranspositionTable &);
+        TranspositionTable &operator=(const TranspositionTable &);
+};
 
 class Map
 {
     public:
+        Map();
+
         bool isWall(position) const;
         bool isWall(Direction dir, Player p) const;
 
@@ -69,13 +203,22 @@ class Map
 
         int cntMoves(Player p) const;
 
-        const std::vector<bool> &getBoard() const;
+        const Bitboard &getBoard() const;
 
         void print(FILE *) const;
 
         position my_pos() const;
         position enemy_pos() const;
 
+        int width() const;
+        int height() const;
+
+        // Hashes the map with keys, which must be for a board its size, and
+        // keeps them to update the hash as moves are made. A map can't be
+        // moved on until it has keys, and keys must outlive it.
+        void setZobrist(const Zobrist *keys);
+
+        // 0 until setZobrist() is called
         HASH_TYPE hash() const;
 
         // Load a board from an open file handle. To read from the console,
@@ -96,13 +239,17 @@ class Map
         // #1# 2#
         // #   ##
         // ######
+        //
+        // The map is read without keys; see setZobrist().
         bool readFromFile(FILE *file_handle);
 
     private:
-        // Indicates whether or not each cell in the board is passable.
-        std::vector<bool> is_wall;
+        // Indicates whether or not each cell in the board is passable. The
+        // padding around the board reads as walls.
+        Bitboard is_wall;
 
         position player_pos[2];
+        const Zobrist *zobrist;
         HASH_TYPE current_hash;
 };
 
@@ -112,7 +259,7 @@ class Map
 inline
 bool Map::isWall(position pos) const
 {
-    return is_wall[index(pos)];
+    return is_wall.get(pos);
 }
 
 inline
@@ -131,10 +278,10 @@ bool Map::isWall(Direction dir, Player p) const
     }
 
     switch (dir) {
-        case NORTH: return is_wall[index(pos.north())];
-        case SOUTH: return is_wall[index(pos.south())];
-        case WEST: return is_wall[index(pos.west())];
-        case EAST: return is_wall[index(pos.east())];
+        case NORTH: return is_wall.get(pos.north());
+        case SOUTH: return is_wall.get(pos.south());
+        case WEST: return is_wall.get(pos.west());
+        case EAST: return is_wall.get(pos.east());
         default: return false;
     }
 }
@@ -154,22 +301,22 @@ int Map::cntMoves(Player p) const
 }
 
 inline
-const std::vector<bool> &Map::getBoard() const
+const Bitboard &Map::getBoard() const
 {
     return is_wall;
 }
 
 inline
-int cntMovesFromSquare(const std::vector<bool> &board, position pos)
+int cntMovesFromSquare(const Bitboard &board, position pos)
 {
     int cnt = 0;
-    if (!board[index(pos.north())])
+    if (!board.get(pos.north()))
         ++cnt;
-    if (!board[index(pos.south())])
+    if (!board.get(pos.south()))
         ++cnt;
-    if (!board[index(pos.west())])
+    if (!board.get(pos.west()))
         ++cnt;
-    if (!board[index(pos.east())])
+    if (!board.get(pos.east()))
         ++cnt;
     return cnt;
 }
@@ -186,6 +333,18 @@ position Map::enemy_pos() const
     return player_pos[1];
 }
 
+inline
+int Map::width() const
+{
+    return is_wall.width();
+}
+
+inline
+int Map::height() const
+{
+    return is_wall.height();
+}
+
 inline HASH_TYPE Map::hash() const
 {
     return current_hash;
@@ -0,0 +1,369 @@
+// Times the kernels the searches spend their time in, one at a time, on
+// generated boards: the territory fill with each of its steps (so the
+// vector versions can be compared with the scalar one), the distance to the
+// opponent, the reachable square count, the isolation test, filling in
+// unreachable squares, and making and unmaking a move.
+//
+// Boards are square, from small up to 200x200, walled in like the contest's
+// maps, with a given share of the squares inside made walls at random and
+// the players put on random free squares (so on the denser boards they are
+// often apart). Everything is made from a fixed seed, so the boards are the
+// same on every run.
+//
+// Each kernel is run in batches long enough for the clock to time well, and
+// every batch is one sample of the time an operation takes. The median,
+// 90th and 99th percentiles and the fastest sample are reported, in
+// nanoseconds and, on x86, in time stamp counter ticks (which run at a fixed
+// rate, not at the core's clock).
+//
+//   microbench [-k kernel] [-s sizes] [-d densities] [-n samples] [-S seed]
+//
+// -k only runs kernels whose names contain the given text; -s and -d take
+// comma separated lists, the densities in percent.
+
+#include "Map.h"
+#include "MoveDeciders.h"
+#include "Voronoi.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MICROBENCH_TSC 1
+#endif
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline uint64_t ticks()
+{
+#ifdef MICROBENCH_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// splitmix64
+static inline uint64_t nextRandom(uint64_t &state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// a generated board, with what the kernels need to run on it
+struct BenchBoard
+{
+    int size, density;
+    int freeSquares;
+    Zobrist keys;
+    Map map;
+    Bitboard copy; // for the kernels that write to the board
+    Direction dir; // a move SELF can make
+};
+
+// Fills board's map in with walls at random, putting the players on free
+// squares with a way out. Returns false if there was no room for them.
+static bool makeBoard(BenchBoard &board, uint64_t seed)
+{
+    const int n = board.size;
+    uint64_t state = seed ^ (uint64_t(n) << 32) ^ uint64_t(board.density);
+
+    std::vector<std::string> rows(n, std::string(n, '#'));
+    for (int y = 1; y < n - 1; ++y) {
+        for (int x = 1; x < n - 1; ++x) {
+            if (int(nextRandom(state) % 100) >= board.density)
+                rows[y][x] = ' ';
+        }
+    }
+
+    for (int p = 0; p < 2; ++p) {
+        int tries = 0;
+        while (true) {
+            if (++tries > n * n * 4)
+                return false;
+            int x = nextRandom(state) % n, y = nextRandom(state) % n;
+            if (rows[y][x] != ' ')
+                continue;
+            // the border keeps the neighbours on the board
+            bool open = rows[y - 1][x] == ' ' || rows[y + 1][x] == ' ' ||
+                rows[y][x - 1] == ' ' || rows[y][x + 1] == ' ';
+            if (open) {
+                rows[y][x] = p == 0 ? '1' : '2';
+                break;
+            }
+        }
+    }
+
+    std::string text;
+    char header[32];
+    snprintf(header, sizeof(header), "%d %d\n", n, n);
+    text = header;
+    board.freeSquares = 0;
+    for (int y = 0; y < n; ++y) {
+        text += rows[y];
+        text += '\n';
+        board.freeSquares += std::count(rows[y].begin(), rows[y].end(), ' ');
+    }
+
+    FILE *fp = fmemopen(&text[0], text.size(), "r");
+    bool ok = fp && board.map.readFromFile(fp);
+    if (fp)
+        fclose(fp);
+    if (!ok)
+        return false;
+
+    board.keys.init(n, n, seed);
+    board.map.setZobrist(&board.keys);
+    board.copy = board.map.getBoard();
+
+    board.dir = NORTH;
+    while (board.map.isWall(board.dir, SELF))
+        board.dir = static_cast<Direction>(board.dir + 1);
+    return true;
+}
+
+typedef int (*KernelFn)(BenchBoard &board);
+
+static int voronoiWith(BenchBoard &board, VoronoiStep step)
+{
+    bool connected;
+    return bbVoronoi(board.map.getBoard(), board.map.my_pos(),
+            board.map.enemy_pos(), &connected, step) + connected;
+}
+
+static int runVoronoiScalar(BenchBoard &board)
+{
+    return voronoiWith(board, voronoiStepScalar);
+}
+
+static int runVoronoiSSE2(BenchBoard &board)
+{
+    return voronoiWith(board, voronoiStepSSE2);
+}
+
+static int runVoronoiAVX2(BenchBoard &board)
+{
+    return voronoiWith(board, voronoiStepAVX2);
+}
+
+static int runDistance(BenchBoard &board)
+{
+    return distanceToOpponent(board.map);
+}
+
+static int runReachable(BenchBoard &board)
+{
+    return countReachableSquares(board.map, SELF);
+}
+
+static int runIsolated(BenchBoard &board)
+{
+    return isOpponentIsolated(board.map);
+}
+
+// the copy is timed along with the fill; see "board copy" for what it costs
+static int runFillUnreachable(BenchBoard &board)
+{
+    board.copy = board.map.getBoard();
+    fillUnreachableSquares(board.copy, board.map.my_pos());
+    return board.copy.words()[board.copy.size() / 2];
+}
+
+static int runBoardCopy(BenchBoard &board)
+{
+    board.copy = board.map.getBoard();
+    return board.copy.words()[board.copy.size() / 2];
+}
+
+static int runMoveUnmove(BenchBoard &board)
+{
+    board.map.move(board.dir, SELF);
+    board.map.unmove(board.dir, SELF);
+    return int(board.map.hash());
+}
+
+struct Kernel
+{
+    const char *name;
+    KernelFn run;
+    bool available;
+};
+
+struct Stats
+{
+    double ns[4]; // median, 90th, 99th percentile, fastest
+    double ticks; // median
+};
+
+static volatile int sink;
+
+// Times kernel on board, in batches of at least BATCH_SECONDS.
+static const double BATCH_SECONDS = 20e-6;
+
+static Stats timeKernel(const Kernel &kernel, BenchBoard &board, int samples)
+{
+    // warm up, and find how many operations make a batch
+    long batch = 1;
+    while (true) {
+        double start = now();
+        for (long i = 0; i < batch; ++i)
+            sink += kernel.run(board);
+        if (now() - start >= BATCH_SECONDS)
+            break;
+        batch *= 2;
+    }
+
+    std::vector<double> ns(samples), tsc(samples);
+    for (int s = 0; s < samples; ++s) {
+        uint64_t t0 = ticks();
+        double start = now();
+        for (long i = 0; i < batch; ++i)
+            sink += kernel.run(board);
+        double elapsed = now() - start;
+        uint64_t t1 = ticks();
+        ns[s] = elapsed * 1e9 / batch;
+        tsc[s] = double(t1 - t0) / batch;
+    }
+
+    std::sort(ns.begin(), ns.end());
+    std::sort(tsc.begin(), tsc.end());
+
+    Stats stats;
+    const double quantiles[3] = {0.5, 0.9, 0.99};
+    for (int q = 0; q < 3; ++q)
+        stats.ns[q] = ns[std::min(samples - 1, int(quantiles[q] * (samples - 1) + 0.5))];
+    stats.ns[3] = ns[0];
+    stats.ticks = tsc[samples / 2];
+    return stats;
+}
+
+static bool parseList(const char *text, std::vector<int> &list)
+{
+    list.clear();
+    while (*text) {
+        char *end;
+        long value = strtol(text, &end, 10);
+        if (end == text)
+            return false;
+        list.push_back(value);
+        text = end;
+        if (*text == ',')
+            ++text;
+        else if (*text)
+            return false;
+    }
+    return !list.empty();
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-k kernel] [-s sizes] [-d densities] [-n samples] [-S seed]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *only = NULL;
+    int samples = 200;
+    uint64_t seed = 0x7472306e;
+
+    std::vector<int> sizes, densities;
+    parseList("15,25,50,100,200", sizes);
+    parseList("0,10,25,40", densities);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:s:d:n:S:")) != -1) {
+        switch (opt) {
+            case 'k': only = optarg; break;
+            case 's': if (!parseList(optarg, sizes)) usage(argv[0]); break;
+            case 'd': if (!parseList(optarg, densities)) usage(argv[0]); break;
+            case 'n': samples = atoi(optarg); break;
+            case 'S': seed = strtoull(optarg, NULL, 0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || samples < 1 || seed == 0)
+        usage(argv[0]);
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (sizes[i] < 4 || sizes[i] > 1000)
+            usage(argv[0]);
+    }
+    for (size_t i = 0; i < densities.size(); ++i) {
+        if (densities[i] < 0 || densities[i] > 90)
+            usage(argv[0]);
+    }
+
+    const Kernel kernels[] = {
+        {"voronoi/scalar", runVoronoiScalar, true},
+        {"voronoi/sse2", runVoronoiSSE2, voronoiStepSSE2 != NULL},
+        {"voronoi/avx2", runVoronoiAVX2, voronoiStepAVX2 != NULL},
+        {"distanceToOpponent", runDistance, true},
+        {"countReachableSquares", runReachable, true},
+        {"isOpponentIsolated", runIsolated, true},
+        {"fillUnreachableSquares", runFillUnreachable, true},
+        {"board copy", runBoardCopy, true},
+        {"move/unmove", runMoveUnmove, true},
+    };
+    const int kernelCount = sizeof(kernels) / sizeof(kernels[0]);
+
+    printf("%-24s %7s %4s %6s %10s %10s %10s %10s %10s\n", "kernel", "size",
+            "dens", "free", "p50 ns", "p90 ns", "p99 ns", "min ns",
+#ifdef MICROBENCH_TSC
+            "p50 ticks"
+#else
+            ""
+#endif
+            );
+
+    for (size_t s = 0; s < sizes.size(); ++s) {
+        for (size_t d = 0; d < densities.size(); ++d) {
+            BenchBoard board;
+            board.size = sizes[s];
+            board.density = densities[d];
+            if (!makeBoard(board, seed)) {
+                printf("%dx%d at %d%%: no room for the players\n",
+                        board.size, board.size, board.density);
+                continue;
+            }
+
+            double scalar = 0;
+            for (int k = 0; k < kernelCount; ++k) {
+                const Kernel &kernel = kernels[k];
+                if (!kernel.available || (only && !strstr(kernel.name, only)))
+                    continue;
+
+                Stats stats = timeKernel(kernel, board, samples);
+                char dims[16];
+                snprintf(dims, sizeof(dims), "%dx%d", board.size, board.size);
+                printf("%-24s %7s %3d%% %6d %10.1f %10.1f %10.1f %10.1f",
+                        kernel.name, dims, board.density, board.freeSquares,
+                        stats.ns[0], stats.ns[1], stats.ns[2], stats.ns[3]);
+#ifdef MICROBENCH_TSC
+                printf(" %10.0f", stats.ticks);
+#endif
+                if (kernel.run == runVoronoiScalar)
+                    scalar = stats.ns[0];
+                else if (scalar > 0 && strncmp(kernel.name, "voronoi/", 8) == 0)
+                    printf("  %.2fx vs scalar", scalar / stats.ns[0]);
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
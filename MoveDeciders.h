@@ -3,15 +3,76 @@
 
 #include "Map.h"
 
-extern volatile bool time_expired;
+class ThreadPool;
+struct SearchContext;
 
+struct SearchOptions
+{
+    // threads searching at once, counting the main one
+    int threads;
+
+    // transposition table size, and whether to fault it all in up front
+    int hashMegabytes;
+    bool prefault;
+
+    // search on the enemy's time while waiting for the next board
+    bool ponder;
+
+    // time kept back from each turn for the engine's latency
+    int marginMs;
+
+    // Each depth of the minimax search starts with a window of
+    // aspirationWindow either side of the last depth's score, which is made
+    // aspirationGrowth times wider on the side the score falls outside of.
+    // A window of 0 always searches the full window.
+    int aspirationWindow;
+    int aspirationGrowth;
+
+    // Whether the minimax search goes a whole move at a time, over the
+    // pairs of moves the players can make at once, rather than a player at
+    // a time.
+    bool jointSearch;
+
+    // Whether the minimax search keeps the territory up to date as it
+    // moves (see IncrementalVoronoi) rather than filling it in again at
+    // every leaf. The scores are the same, but in open rooms a move changes
+    // about half the board, which the bitboard fill gets through faster.
+    bool incrementalTerritory;
+
+    // file the endgame tablebase is kept in, or NULL to keep it in memory
+    const char *tablebasePath;
+
+    // what the Zobrist keys are made from, or 0 to draw them at random
+    uint64_t zobristSeed;
+
+    // Where a line of JSON about each turn goes, as for TelemetryLog::open,
+    // or NULL for nowhere. The search is only timed in parts if it is set;
+    // an Engine whose log can't be opened searches as if it weren't.
+    const char *telemetryPath;
+
+    SearchOptions();
+};
+
+
+// The deciders search map, which must be hashed with context's keys, within
+// the turn context's time manager was started for.
 bool isOpponentIsolated(const Map &map);
-Direction decideMoveIsolatedFromOpponent(Map map);
+Direction decideMoveIsolatedFromOpponent(Map map, SearchContext &context,
+        ThreadPool &helpers);
 int countReachableSquares(const Map &map, Player player);
-Direction decideMoveMinimax(Map);
-bool squaresReachEachOther(const std::vector<bool> &board,
+// moves it would take to reach the enemy's square, or -1 if it can't be
+int distanceToOpponent(const Map &map);
+Direction decideMoveMinimax(Map, SearchContext &context, ThreadPool &helpers);
+
+// Searches on from the position after myMove and the reply the last minimax
+// search expected, on the ponderer's thread, until stopPondering is called.
+// Returns false if there was nothing to ponder.
+bool startPondering(const Map &map, Direction myMove, SearchContext &context,
+        ThreadPool &ponderer);
+void stopPondering(SearchContext &context, ThreadPool &ponderer);
+bool squaresReachEachOther(const Bitboard &board,
         position pos1, position pos2);
-void fillUnreachableSquares(std::vector<bool> &board, position pos);
-bool isCorridorSquare(const std::vector<bool> &board, position pos);
+void fillUnreachableSquares(Bitboard &board, position pos);
+bool isCorridorSquare(const Bitboard &board, position pos);
 
 #endif
@@ -1,28 +1,112 @@
 #include "Map.h"
-#include "MoveDeciders.h"
+#include "Engine.h"
+#include "Tablebase.h"
 #include <vector>
 #include <cstdio>
 #include <set>
 #include <iterator>
 #include <algorithm>
 
-#include <sys/time.h>
-#include <signal.h>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
 
-volatile bool time_expired;
+// What the engine allows for a turn. The first turn's allowance is kept to
+// what the bot has always used for it, plus the default margin.
+static const double FIRST_TURN_SECONDS = 2.55;
+static const double TURN_SECONDS = 1.0;
 
-Direction decide_move(const Map &map)
+// size of a new tablebase file (16 bytes an entry)
+static const size_t TABLEBASE_ENTRIES = 4 * 1024 * 1024;
+
+// options come from the environment first, then the command line:
+//   -t N, TRON_THREADS=N   search with N threads
+//   -m N, TRON_HASH_MB=N   use about N megabytes of transposition table
+//   -p, TRON_PREFAULT=1    fault the transposition table in at startup
+//   -P, TRON_PONDER=1      search while the enemy is thinking
+//   -s N, TRON_MARGIN_MS=N keep N milliseconds of each turn for latency
+//   -w N, TRON_ASPIRATION=N
+//                          start each depth N either side of the last score,
+//                          or with the full window if N is 0
+//   -g N, TRON_ASPIRATION_GROWTH=N
+//                          widen a window that misses by N times
+//   -j, TRON_JOINT=1       search both players' moves together
+//   -i, TRON_INCREMENTAL=1 keep the territory up to date through the search
+//   -b F, TRON_TABLEBASE=F keep the endgame tablebase in file F
+//   -l F, TRON_TELEMETRY=F append a line of JSON about each turn to file F,
+//                          or to descriptor N if F is fd:N
+static bool parse_options(int argc, char **argv, SearchOptions &options)
 {
-    if (isOpponentIsolated(map)) {
-        return decideMoveIsolatedFromOpponent(map);
-    }
+    const char *env = getenv("TRON_THREADS");
+    if (env)
+        options.threads = atoi(env);
+    env = getenv("TRON_HASH_MB");
+    if (env)
+        options.hashMegabytes = atoi(env);
+    env = getenv("TRON_PREFAULT");
+    if (env)
+        options.prefault = atoi(env) != 0;
+    env = getenv("TRON_PONDER");
+    if (env)
+        options.ponder = atoi(env) != 0;
+    env = getenv("TRON_MARGIN_MS");
+    if (env)
+        options.marginMs = atoi(env);
+    env = getenv("TRON_ASPIRATION");
+    if (env)
+        options.aspirationWindow = atoi(env);
+    env = getenv("TRON_ASPIRATION_GROWTH");
+    if (env)
+        options.aspirationGrowth = atoi(env);
+    env = getenv("TRON_JOINT");
+    if (env)
+        options.jointSearch = atoi(env) != 0;
+    env = getenv("TRON_INCREMENTAL");
+    if (env)
+        options.incrementalTerritory = atoi(env) != 0;
+    env = getenv("TRON_TABLEBASE");
+    if (env)
+        options.tablebasePath = env;
+    env = getenv("TRON_TELEMETRY");
+    if (env)
+        options.telemetryPath = env;
 
-    return decideMoveMinimax(map);
-}
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:pPs:w:g:jib:l:")) != -1) {
+        switch (opt) {
+            case 't': options.threads = atoi(optarg); break;
+            case 'm': options.hashMegabytes = atoi(optarg); break;
+            case 'p': options.prefault = true; break;
+            case 'P': options.ponder = true; break;
+            case 's': options.marginMs = atoi(optarg); break;
+            case 'w': options.aspirationWindow = atoi(optarg); break;
+            case 'g': options.aspirationGrowth = atoi(optarg); break;
+            case 'j': options.jointSearch = true; break;
+            case 'i': options.incrementalTerritory = true; break;
+            case 'b': options.tablebasePath = optarg; break;
+            case 'l': options.telemetryPath = optarg; break;
+            default: return false;
+        }
+    }
 
-void handle_sigalrm(int)
-{
-    time_expired = true;
+    if (options.threads < 1) {
+        fprintf(stderr, "need at least one search thread\n");
+        return false;
+    }
+    if (options.marginMs < 0) {
+        fprintf(stderr, "the safety margin can't be negative\n");
+        return false;
+    }
+    if (options.aspirationWindow < 0 || options.aspirationGrowth < 2) {
+        fprintf(stderr, "the aspiration window can't be negative, and has to grow by at least 2\n");
+        return false;
+    }
+    if (options.hashMegabytes < 1) {
+        fprintf(stderr, "need at least a megabyte of transposition table\n");
+        return false;
+    }
+    return true;
 }
 
 void send_move(Direction move)
@@ -40,32 +124,48 @@ void send_move(Direction move)
 
 
 
-int main()
+int main(int argc, char **argv)
 {
+    SearchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        fprintf(stderr, "usage: %s [-t threads] [-m megabytes] [-p] [-P] [-s margin_ms] [-w window] [-g growth] [-j] [-i] [-b tablebase] [-l telemetry]\n", argv[0]);
+        return 1;
+    }
+
+    // the entries are solved as they come up, so a table that can't be
+    // opened just means starting with an empty one
+    if (options.tablebasePath)
+        tablebase.open(options.tablebasePath, TABLEBASE_ENTRIES);
+
+    Engine engine(options);
     Map map;
 
     bool first_time = true;
 
-    signal(SIGALRM, &handle_sigalrm);
-
-    while (map.readFromFile(stdin))
+    while (true)
     {
-        time_expired = false;
+        if (options.ponder && !first_time) {
+            // keep pondering until the next board starts arriving
+            pollfd pfd;
+            pfd.fd = fileno(stdin);
+            pfd.events = POLLIN;
+            while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+                ;
+            engine.stopPondering();
+        }
 
-        itimerval itv;
-        itv.it_interval.tv_sec = 0;
-        itv.it_interval.tv_usec = 0;
+        if (!map.readFromFile(stdin))
+            break;
+
+        Direction move;
         if (first_time) {
             first_time = false;
-            itv.it_value.tv_sec = 2;
-            itv.it_value.tv_usec = 500000;
+            engine.newGame(map);
+            move = engine.decide(map, FIRST_TURN_SECONDS);
         } else {
-            itv.it_value.tv_sec = 0;
-            itv.it_value.tv_usec = 950000;
+            move = engine.decide(map, TURN_SECONDS);
         }
-        setitimer(ITIMER_REAL, &itv, NULL);
-
-        send_move(decide_move(map));
+        send_move(move);
     }
     return 0;
 }
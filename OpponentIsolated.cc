@@ -1,47 +1,62 @@
 #include "MoveDeciders.h"
+#include "Scratch.h"
+#include "ThreadPool.h"
+#include "Tablebase.h"
+#include "Engine.h"
 
 #include <cstdio>
-#include <stdexcept>
 #include <climits>
 #include <utility>
 #include <cassert>
+#include <vector>
+#include <algorithm>
 
 
-static bool floodFillReachesOtherSquare(std::vector<bool> &board,
-        position pos1, position pos2)
+static inline bool visitReaching(const Bitboard &board, Scratch &scratch,
+        position pos, position target)
 {
-    if (pos1 == pos2)
+    if (pos == target)
         return true;
 
-    board[index(pos1)] = true;
+    if (!board.get(pos) && scratch.visit(board.bitIndex(pos)))
+        scratch.stack.push_back(pos);
+    return false;
+}
 
-    if (!board[index(pos1.north())] &&
-            floodFillReachesOtherSquare(board, pos1.north(), pos2))
+// pos1 and pos2 are treated as free squares even if they are walls (they
+// are usually the players' own squares). The board itself is never written,
+// visited squares are tracked in the thread's scratch visit stamps.
+static bool floodFillReachesOtherSquare(const Bitboard &board,
+        position pos1, position pos2)
+{
+    if (pos1 == pos2)
         return true;
 
-    if (!board[index(pos1.south())] &&
-            floodFillReachesOtherSquare(board, pos1.south(), pos2))
-        return true;
+    Scratch &scratch = threadScratch();
+    std::vector<position> &stack = scratch.stack;
 
-    if (!board[index(pos1.west())] &&
-            floodFillReachesOtherSquare(board, pos1.west(), pos2))
-        return true;
+    scratch.startVisits(board);
+    scratch.visit(board.bitIndex(pos1));
+    stack.clear();
+    stack.push_back(pos1);
 
-    if (!board[index(pos1.east())] &&
-            floodFillReachesOtherSquare(board, pos1.east(), pos2))
-        return true;
+    while (!stack.empty()) {
+        position pos = stack.back();
+        stack.pop_back();
+
+        if (visitReaching(board, scratch, pos.north(), pos2) ||
+                visitReaching(board, scratch, pos.south(), pos2) ||
+                visitReaching(board, scratch, pos.west(), pos2) ||
+                visitReaching(board, scratch, pos.east(), pos2))
+            return true;
+    }
 
     return false;
 }
 
-bool squaresReachEachOther(const std::vector<bool> &boardOrig,
+bool squaresReachEachOther(const Bitboard &board,
         position pos1, position pos2)
 {
-    std::vector<bool> board(boardOrig);
-
-    board[index(pos1)] = false;
-    board[index(pos2)] = false;
-
     return floodFillReachesOtherSquare(board, pos1, pos2);
 }
 
@@ -50,17 +65,262 @@ bool isOpponentIsolated(const Map &map)
     return !squaresReachEachOther(map.getBoard(), map.my_pos(), map.enemy_pos());
 }
 
-static std::pair<int, int> isolatedPathFind(Map &map, int truedepth, int depth, Direction *outDir)
+// The exact fill search's memo. Its keys leave out everything but the
+// player's own region, which is all a longest path there depends on, so
+// they still match on later turns however the enemy has moved. A key starts
+// as the xor of the wall hashes of the region's free squares and the
+// player hash of its square; a move changes that the same way it changes
+// Map::hash(), so a position's key is its hash xor'd with an offset that
+// is fixed for the turn. The memo is the engine's fillTable. It is never
+// aged, since what it holds stays true on later turns; instead an entry's
+// depth is the size of its region (up to the table's MAX_DEPTH), so when a
+// bucket is full the smallest region, the cheapest to solve again, goes.
+
+// share of a turn the exact search gets before the depth limited one
+static const double EXACT_SHARE = 0.5;
+
+static inline void visitRegion(const Bitboard &board, Scratch &scratch,
+        const Zobrist &zobrist, position pos, HASH_TYPE &key)
+{
+    if (!board.get(pos) && scratch.visit(board.bitIndex(pos))) {
+        key ^= zobrist.wall(pos);
+        scratch.stack.push_back(pos);
+    }
+}
+
+static HASH_TYPE regionOffset(const Map &map, const Zobrist &zobrist)
+{
+    const Bitboard &board = map.getBoard();
+    Scratch &scratch = threadScratch();
+    std::vector<position> &stack = scratch.stack;
+
+    HASH_TYPE key = zobrist.player(SELF, map.my_pos());
+    scratch.startVisits(board);
+    scratch.visit(board.bitIndex(map.my_pos()));
+    stack.clear();
+    stack.push_back(map.my_pos());
+
+    while (!stack.empty()) {
+        position pos = stack.back();
+        stack.pop_back();
+
+        visitRegion(board, scratch, zobrist, pos.north(), key);
+        visitRegion(board, scratch, zobrist, pos.south(), key);
+        visitRegion(board, scratch, zobrist, pos.west(), key);
+        visitRegion(board, scratch, zobrist, pos.east(), key);
+    }
+
+    return key ^ map.hash();
+}
+
+// The isolated searches count into the stats of the thread they run on,
+// the way the minimax search does, and the times are only kept when there
+// is a telemetry log to write them to.
+static inline int reachableSquares(const Map &map, SearchContext &context,
+        SearchStats &stats)
 {
-    if (time_expired)
-        throw std::runtime_error("time expired");
+    StatTimer timer(context.options.telemetryPath != NULL, stats.fillTicks);
+    return countReachableSquares(map, SELF);
+}
+
+static inline bool probeFill(SearchContext &context, SearchStats &stats,
+        HASH_TYPE key, TranspositionTable::Entry &entry)
+{
+    ++stats.ttProbes;
+    bool collided;
+    if (!context.fillTable.get(key, entry, &collided)) {
+        if (collided)
+            ++stats.ttCollisions;
+        return false;
+    }
+    ++stats.ttHits;
+    return true;
+}
+
+static inline position step(position pos, Direction dir)
+{
+    switch (dir) {
+        case NORTH: return pos.north();
+        case SOUTH: return pos.south();
+        case WEST: return pos.west();
+        default: return pos.east();
+    }
+}
+
+// The longest path from the player's square, which is exact if it is more
+// than target; otherwise all that is known is that it is no more than
+// what is returned (which is no more than target). The chamber bound
+// prunes moves that can't beat the best so far, and stops the search as
+// soon as a path reaches it.
+static int fillSearch(Map &map, SearchContext &context, SearchStats &stats,
+        HASH_TYPE offset, int target, Direction *bestDir)
+{
+    if (context.deadline.expired())
+        return 0;
+    ++stats.nodes;
+
+    int region = reachableSquares(map, context, stats);
+    int bound = region;
+    if (bound <= target)
+        return bound;
+
+    // the root has to search for the move that goes with the length
+    int exact;
+    if (!bestDir && bound < Tablebase::MAX_CELLS &&
+            tablebase.longestPath(map.getBoard(), map.my_pos(), &exact,
+                context.deadline))
+        return exact;
+
+    HASH_TYPE key = map.hash() ^ offset;
+    TranspositionTable::Entry entry;
+    if (probeFill(context, stats, key, entry)) {
+        if (entry.bound == TranspositionTable::BOUND_EXACT &&
+                (!bestDir || entry.move != TranspositionTable::NO_MOVE)) {
+            if (bestDir)
+                *bestDir = static_cast<Direction>(entry.move);
+            return entry.value;
+        }
+        if (entry.bound == TranspositionTable::BOUND_UPPER) {
+            if (entry.value <= target)
+                return entry.value;
+            bound = std::min(bound, entry.value);
+        }
+    }
+
+    // the move that was best before goes first, then the ones that leave
+    // the fewest ways on, which hug the walls
+    Direction moves[4];
+    int ways[4];
+    int cnt = 0;
+    for (Direction dir = DIR_MIN; dir <= DIR_MAX;
+            dir = static_cast<Direction>(dir + 1)) {
+        if (map.isWall(dir, SELF))
+            continue;
+
+        int w = dir == entry.move ? -1 :
+            cntMovesFromSquare(map.getBoard(), step(map.my_pos(), dir));
+        int j = cnt++;
+        for (; j > 0 && ways[j - 1] > w; --j) {
+            moves[j] = moves[j - 1];
+            ways[j] = ways[j - 1];
+        }
+        moves[j] = dir;
+        ways[j] = w;
+    }
 
-    if (depth <= 0)
-        return std::make_pair(truedepth, countReachableSquares(map, SELF));
+    int best = 0;
+    Direction bestMove = NORTH;
+    for (int i = 0; i < cnt && best < bound; ++i) {
+        map.move(moves[i], SELF);
+        int len = 1 + fillSearch(map, context, stats, offset,
+                std::max(target, best) - 1, NULL);
+        map.unmove(moves[i], SELF);
+        if (context.deadline.stopped())
+            return 0;
+
+        if (len > best) {
+            best = len;
+            bestMove = moves[i];
+        }
+    }
+
+    TranspositionTable::Entry result;
+    result.value = best;
+    result.depth = std::min(region, int(TranspositionTable::MAX_DEPTH));
+    if (best > target) {
+        result.bound = TranspositionTable::BOUND_EXACT;
+        if (cnt > 0)
+            result.move = bestMove;
+    } else {
+        result.bound = TranspositionTable::BOUND_UPPER;
+    }
+    context.fillTable.set(key, result);
+
+    if (bestDir && cnt > 0)
+        *bestDir = bestMove;
+    return best;
+}
+
+// Each turn's deepening step is split into the positions a couple of moves
+// from the root, which the main thread and the helpers take from a shared
+// counter. The best score found by any thread is shared as well, and a
+// subtree whose reachable square bound can't beat it is skipped.
+#define SPLIT_PLIES 2
+
+struct IsolatedTask
+{
+    Direction moves[SPLIT_PLIES];
+    int nmoves;
+    int truedepth, depth, limit;
+    std::pair<int, int> result;
+    bool done;
+};
+
+struct IsolatedSearch
+{
+    SearchContext *context;
+    const Map *map;
+    HASH_TYPE offset; // for the exact search's memo
+    SearchStats *stats; // the main thread's, then one for each helper
+    std::vector<IsolatedTask> tasks;
+    int next;
+    int best;
+};
+
+static void raiseBest(int *best, int score)
+{
+    int cur = __atomic_load_n(best, __ATOMIC_RELAXED);
+    while (score > cur && !__atomic_compare_exchange_n(best, &cur, score,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// The reachable square count is a true upper bound on how much further a
+// path can go, so a square's count is capped at one less than its parent's.
+// That keeps the scores consistent with the pruning below.
+static std::pair<int, int> isolatedPathFind(Map &map, SearchContext &context,
+        SearchStats &stats, HASH_TYPE offset, int truedepth, int depth,
+        int limit, int *best)
+{
+    if (context.deadline.expired())
+        return std::make_pair(truedepth, 0);
+    ++stats.nodes;
+
+    int count = std::min(reachableSquares(map, context, stats), limit);
+
+    // a small enough chamber has an exact answer, which ends the search
+    // here
+    int exact;
+    if (count < Tablebase::MAX_CELLS &&
+            tablebase.longestPath(map.getBoard(), map.my_pos(), &exact,
+                context.deadline)) {
+        raiseBest(best, truedepth + exact);
+        return std::make_pair(truedepth, exact);
+    }
+
+    // and so does anything the exact search has solved
+    TranspositionTable::Entry entry;
+    if (probeFill(context, stats, map.hash() ^ offset, entry)) {
+        if (entry.bound == TranspositionTable::BOUND_EXACT) {
+            raiseBest(best, truedepth + entry.value);
+            return std::make_pair(truedepth, entry.value);
+        }
+        count = std::min(count, entry.value);
+    }
+
+    if (depth <= 0) {
+        raiseBest(best, truedepth + count);
+        return std::make_pair(truedepth, count);
+    }
+
+    // Nothing below here can beat what has been found already. A subtree
+    // that can only tie is still searched, since which of two tied tasks
+    // is cut would otherwise depend on which thread got there first.
+    if (truedepth + count < __atomic_load_n(best, __ATOMIC_RELAXED))
+        return std::make_pair(truedepth, 0);
 
     int bestCount = 0;
     int bestTrueDepth = truedepth;
-    Direction bestDir = NORTH;
 
     // singularity enhancement
     int newdepth = depth - 1;
@@ -73,40 +333,158 @@ static std::pair<int, int> isolatedPathFind(Map &map, int truedepth, int depth,
             continue;
 
         map.move(dir, SELF);
-        std::pair<int, int> tmp = isolatedPathFind(map, truedepth + 1, newdepth, NULL);
+        std::pair<int, int> tmp = isolatedPathFind(map, context, stats,
+                offset, truedepth + 1, newdepth, count - 1, best);
         map.unmove(dir, SELF);
+        if (context.deadline.stopped())
+            break;
 
         if (tmp.first + tmp.second > bestTrueDepth + bestCount) {
             bestTrueDepth = tmp.first;
             bestCount = tmp.second;
-            bestDir = dir;
         }
     }
 
-    if (outDir)
-        *outDir = bestDir;
-
     return std::make_pair(bestTrueDepth, bestCount);
 }
 
-Direction decideMoveIsolatedFromOpponent(Map map)
+// Walks the first SPLIT_PLIES moves the same way isolatedPathFind would,
+// leaving a task for each position it stops at.
+static void splitIsolatedSearch(Map &map, IsolatedTask &task,
+        std::vector<IsolatedTask> &tasks)
 {
-    Direction dir = NORTH, tmpDir = NORTH;
-    std::pair<int, int> depthCount;
+    if (task.nmoves == SPLIT_PLIES || task.depth <= 0 ||
+            map.cntMoves(SELF) == 0) {
+        tasks.push_back(task);
+        return;
+    }
 
-    try {
-        int depth = 0;
-        do {
-            dir = tmpDir;
-            //fprintf(stderr, "isolated path depth %d ==> %s, found depth: %d, count: %d\n", depth, dirToString(dir), depthCount.first, depthCount.second);
+    int newdepth = task.depth - 1;
+    if (map.cntMoves(SELF) == 1)
+        newdepth = task.depth;
+    int count = std::min(countReachableSquares(map, SELF), task.limit);
 
-            ++depth;
-            depthCount = isolatedPathFind(map, 0, depth, &tmpDir);
-        } while (depthCount.first >= depth);
-    } catch (...) {
+    for (Direction dir = DIR_MIN; dir <= DIR_MAX;
+            dir = static_cast<Direction>(dir + 1)) {
+        if (map.isWall(dir, SELF))
+            continue;
+
+        IsolatedTask child = task;
+        child.moves[child.nmoves++] = dir;
+        ++child.truedepth;
+        child.depth = newdepth;
+        child.limit = count - 1;
+
+        map.move(dir, SELF);
+        splitIsolatedSearch(map, child, tasks);
+        map.unmove(dir, SELF);
     }
+}
 
-    return dir;
+static void runIsolatedTasks(void *arg, int helper)
+{
+    IsolatedSearch &search = *static_cast<IsolatedSearch *>(arg);
+    SearchContext &context = *search.context;
+    SearchStats &stats = search.stats[helper + 1];
+    Map map(*search.map);
+
+    while (true) {
+        int i = __atomic_fetch_add(&search.next, 1, __ATOMIC_RELAXED);
+        if (i >= int(search.tasks.size()))
+            break;
+
+        IsolatedTask &task = search.tasks[i];
+        for (int m = 0; m < task.nmoves; ++m)
+            map.move(task.moves[m], SELF);
+        task.result = isolatedPathFind(map, context, stats, search.offset,
+                task.truedepth, task.depth, task.limit, &search.best);
+        for (int m = task.nmoves - 1; m >= 0; --m)
+            map.unmove(task.moves[m], SELF);
 
+        // a task that was stopped part way leaves the whole depth unfinished
+        if (context.deadline.stopped())
+            break;
+        task.done = true;
+    }
 }
 
+Direction decideMoveIsolatedFromOpponent(Map map, SearchContext &context,
+        ThreadPool &helpers)
+{
+    // any move that doesn't crash is better than nothing if neither search
+    // gets anywhere, and with only one there is nothing to think about
+    Direction dir = NORTH;
+    while (dir < DIR_MAX && map.isWall(dir, SELF))
+        dir = static_cast<Direction>(dir + 1);
+    if (map.cntMoves(SELF) <= 1)
+        return dir;
+
+    // The exact search gets the first part of the turn. If it doesn't
+    // finish, what it learned stays in its memo for the depth limited
+    // search and for the next turn, so a region too big to solve in one
+    // turn can still be solved over a few.
+    HASH_TYPE offset = regionOffset(map, context.zobrist);
+    context.deadline.start(context.time.remaining() * EXACT_SHARE);
+    SearchStats fillStats;
+    fillSearch(map, context, fillStats, offset, -1, &dir);
+    context.turnStats.add(fillStats);
+    if (!context.deadline.stopped())
+        return dir;
+    context.deadline.start(context.time.remaining());
+
+    std::vector<SearchStats> threadStats(helpers.size() + 1);
+    IsolatedSearch search;
+    search.context = &context;
+    search.map = &map;
+    search.offset = offset;
+    search.stats = &threadStats[0];
+
+    int depth = 0;
+    while (true) {
+        ++depth;
+
+        IsolatedTask root;
+        root.nmoves = 0;
+        root.truedepth = 0;
+        root.depth = depth;
+        root.limit = INT_MAX;
+        root.result = std::make_pair(0, 0);
+        root.done = false;
+
+        search.tasks.clear();
+        splitIsolatedSearch(map, root, search.tasks);
+        search.next = 0;
+        search.best = 0;
+
+        helpers.start(&runIsolatedTasks, &search);
+        runIsolatedTasks(&search, -1);
+        helpers.wait();
+        for (size_t i = 0; i < threadStats.size(); ++i) {
+            context.turnStats.add(threadStats[i]);
+            threadStats[i].clear();
+        }
+
+        // the tasks are in the order a single thread would search them, so
+        // ties go the same way
+        std::pair<int, int> best(0, 0);
+        Direction bestDir = NORTH;
+        bool complete = true;
+        for (size_t i = 0; i < search.tasks.size(); ++i) {
+            const IsolatedTask &task = search.tasks[i];
+            complete = complete && task.done;
+            if (task.result.first + task.result.second > best.first + best.second) {
+                best = task.result;
+                bestDir = task.nmoves > 0 ? task.moves[0] : NORTH;
+            }
+        }
+        if (!complete)
+            break;
+
+        dir = bestDir;
+        //fprintf(stderr, "isolated path depth %d ==> %s, found depth: %d, count: %d\n", depth, dirToString(dir), best.first, best.second);
+        if (best.first < depth)
+            break;
+    }
+
+    return dir;
+}
@@ -0,0 +1,553 @@
+// Runs lots of games between two bots on this machine, several at once.
+//
+// It speaks the contest engine's protocol: every turn each bot is sent the
+// board, "width height" and then the rows, with itself as '1' and the other
+// bot as '2', and answers with a line holding 1 to 4 (north, east, south,
+// west). Both move at once. A bot that moves into a wall or trail, or into
+// the other bot's square, crashes, and so does one that answers late or
+// with anything else; the other bot wins, unless both crashed or they moved
+// into the same square, which is a draw.
+//
+// Every map is played the same number of times from each side, and at the
+// end the first bot's wins, losses and draws are reported, by map and in
+// total, along with how long each bot took to move.
+//
+//   referee [-j jobs] [-r rounds] [-t seconds] [-f seconds] [-v] bot1 bot2 maps...
+
+#include "ThreadPool.h"
+#include "position.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the board as the engine keeps it: '#' for walls and trails, ' ' for free
+// squares and '1' and '2' for the players
+struct Board
+{
+    int width, height;
+    std::vector<std::string> rows;
+    position pos[2];
+
+    bool load(const char *file);
+    std::string text(int player) const;
+    char &at(position p);
+};
+
+bool Board::load(const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    if (!fp) {
+        perror(file);
+        return false;
+    }
+
+    bool ok = fscanf(fp, "%d %d\n", &width, &height) == 2 &&
+        width > 0 && height > 0;
+    bool found[2] = {false, false};
+    std::string row;
+    int c;
+    while (ok && int(rows.size()) < height && (c = fgetc(fp)) != EOF) {
+        switch (c) {
+            case '\r':
+                break;
+            case '\n':
+                ok = int(row.size()) == width;
+                rows.push_back(row);
+                row.clear();
+                break;
+            case '1':
+            case '2':
+                pos[c - '1'] = position(row.size(), rows.size());
+                found[c - '1'] = true;
+                row += c;
+                break;
+            case '#':
+            case ' ':
+                row += c;
+                break;
+            default:
+                ok = false;
+                break;
+        }
+    }
+    if (ok && int(rows.size()) < height && int(row.size()) == width)
+        rows.push_back(row);
+    fclose(fp);
+
+    if (!ok || int(rows.size()) != height || !found[0] || !found[1]) {
+        fprintf(stderr, "%s isn't a valid map\n", file);
+        return false;
+    }
+    return true;
+}
+
+std::string Board::text(int player) const
+{
+    char header[32];
+    snprintf(header, sizeof(header), "%d %d\n", width, height);
+
+    std::string out(header);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            char c = rows[y][x];
+            if (c == '1' || c == '2')
+                c = c - '1' == player ? '1' : '2';
+            out += c;
+        }
+        out += '\n';
+    }
+    return out;
+}
+
+inline char &Board::at(position p)
+{
+    return rows[p.y][p.x];
+}
+
+// one bot process, talking over a pipe each way
+struct Bot
+{
+    pid_t pid;
+    int to, from;
+    std::string pending; // read but not yet a whole line
+
+    Bot();
+    ~Bot();
+
+    bool start(const char *command);
+    void stop();
+    bool send(const std::string &text);
+};
+
+Bot::Bot() :
+    pid(-1), to(-1), from(-1)
+{
+}
+
+Bot::~Bot()
+{
+    stop();
+}
+
+// the pipes are close-on-exec so that bots started by other games at the
+// same time don't hold on to them
+bool Bot::start(const char *command)
+{
+    int in[2], out[2];
+    if (pipe2(in, O_CLOEXEC) < 0)
+        return false;
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        close(in[0]);
+        close(in[1]);
+        return false;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0)
+            dup2(null, 2);
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+
+    close(in[0]);
+    close(out[1]);
+    to = in[1];
+    from = out[0];
+    if (pid < 0) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void Bot::stop()
+{
+    if (to >= 0)
+        close(to);
+    if (from >= 0)
+        close(from);
+    to = from = -1;
+
+    if (pid > 0) {
+        kill(pid, SIGKILL);
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+            ;
+    }
+    pid = -1;
+}
+
+bool Bot::send(const std::string &text)
+{
+    size_t done = 0;
+    while (done < text.size()) {
+        ssize_t n = write(to, text.data() + done, text.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+// Waits until both bots have answered or the time is up. A move is 0 if
+// the bot didn't answer in time, or -1 if it answered with something that
+// isn't a move; times are how long each took to answer.
+static void readMoves(Bot *bots, double started, double limit,
+        int *moves, double *times)
+{
+    bool waiting[2] = {true, true};
+    moves[0] = moves[1] = 0;
+    times[0] = times[1] = limit;
+
+    while (waiting[0] || waiting[1]) {
+        // a whole line may have come in with the last one
+        for (int p = 0; p < 2; ++p) {
+            if (!waiting[p])
+                continue;
+            size_t eol = bots[p].pending.find('\n');
+            if (eol == std::string::npos)
+                continue;
+            std::string line = bots[p].pending.substr(0, eol);
+            bots[p].pending.erase(0, eol + 1);
+            moves[p] = line.size() >= 1 && line[0] >= '1' && line[0] <= '4' &&
+                (line.size() == 1 || line[1] == '\r') ? line[0] - '0' : -1;
+            times[p] = now() - started;
+            waiting[p] = false;
+        }
+        if (!waiting[0] && !waiting[1])
+            break;
+
+        double left = started + limit - now();
+        if (left <= 0)
+            break;
+
+        pollfd pfds[2];
+        int which[2], n = 0;
+        for (int p = 0; p < 2; ++p) {
+            if (!waiting[p])
+                continue;
+            pfds[n].fd = bots[p].from;
+            pfds[n].events = POLLIN;
+            which[n++] = p;
+        }
+        int ready = poll(pfds, n, int(left * 1000) + 1);
+        if (ready < 0 && errno != EINTR)
+            break;
+
+        for (int i = 0; i < n && ready > 0; ++i) {
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            int p = which[i];
+            char buf[256];
+            ssize_t got = read(bots[p].from, buf, sizeof(buf));
+            if (got > 0) {
+                bots[p].pending.append(buf, got);
+            } else if (got == 0 || errno != EINTR) {
+                // the bot is gone
+                moves[p] = -1;
+                times[p] = now() - started;
+                waiting[p] = false;
+            }
+        }
+    }
+}
+
+static position step(position p, int move)
+{
+    switch (move) {
+        case 1: return p.north();
+        case 2: return p.east();
+        case 3: return p.south();
+        default: return p.west();
+    }
+}
+
+struct BotStats
+{
+    long moves;
+    double total, longest;
+    int timeouts, badMoves;
+
+    BotStats() : moves(0), total(0), longest(0), timeouts(0), badMoves(0) {}
+    void add(const BotStats &o);
+};
+
+void BotStats::add(const BotStats &o)
+{
+    moves += o.moves;
+    total += o.total;
+    longest = std::max(longest, o.longest);
+    timeouts += o.timeouts;
+    badMoves += o.badMoves;
+}
+
+struct Game
+{
+    int map;
+    bool swapped; // the second bot plays '1'
+
+    // filled in by playGame, for the first bot
+    int outcome; // 1 won, 0 drew, -1 lost
+    int turns;
+    BotStats stats[2];
+};
+
+struct Match
+{
+    const char *commands[2];
+    std::vector<const char *> mapNames;
+    std::vector<Board> maps;
+    double moveLimit, firstMoveLimit;
+    bool verbose;
+
+    std::vector<Game> games;
+    int next;
+    pthread_mutex_t lock;
+};
+
+static void playGame(const Match &match, Game &game)
+{
+    Board board = match.maps[game.map];
+
+    // bots[p] plays '1' + p; bot is which of the match's bots that is
+    Bot bots[2];
+    int bot[2];
+    for (int p = 0; p < 2; ++p) {
+        bot[p] = game.swapped ? 1 - p : p;
+        if (!bots[p].start(match.commands[bot[p]]))
+            perror("failed to start a bot");
+    }
+
+    game.turns = 0;
+    while (true) {
+        double limit = game.turns == 0 ? match.firstMoveLimit : match.moveLimit;
+        double started = now();
+        for (int p = 0; p < 2; ++p)
+            bots[p].send(board.text(p));
+
+        int moves[2];
+        double times[2];
+        readMoves(bots, started, limit, moves, times);
+        ++game.turns;
+
+        bool crashed[2];
+        position next[2];
+        for (int p = 0; p < 2; ++p) {
+            BotStats &stats = game.stats[bot[p]];
+            ++stats.moves;
+            stats.total += times[p];
+            stats.longest = std::max(stats.longest, times[p]);
+            if (moves[p] == 0)
+                ++stats.timeouts;
+            else if (moves[p] < 0)
+                ++stats.badMoves;
+
+            crashed[p] = moves[p] <= 0;
+            if (!crashed[p]) {
+                next[p] = step(board.pos[p], moves[p]);
+                crashed[p] = board.at(next[p]) != ' ';
+            }
+        }
+        if (!crashed[0] && !crashed[1] &&
+                next[0].x == next[1].x && next[0].y == next[1].y)
+            crashed[0] = crashed[1] = true;
+
+        if (crashed[0] || crashed[1]) {
+            int first = game.swapped ? 1 : 0;
+            if (crashed[0] && crashed[1])
+                game.outcome = 0;
+            else
+                game.outcome = crashed[first] ? -1 : 1;
+            break;
+        }
+
+        for (int p = 0; p < 2; ++p) {
+            board.at(board.pos[p]) = '#';
+            board.at(next[p]) = '1' + p;
+            board.pos[p] = next[p];
+        }
+    }
+}
+
+static const char *outcomeName(int outcome)
+{
+    switch (outcome) {
+        case 1: return "won";
+        case -1: return "lost";
+        default: return "drew";
+    }
+}
+
+static void runGames(void *arg, int)
+{
+    Match &match = *static_cast<Match *>(arg);
+
+    while (true) {
+        int i = __atomic_fetch_add(&match.next, 1, __ATOMIC_RELAXED);
+        if (i >= int(match.games.size()))
+            break;
+
+        Game &game = match.games[i];
+        playGame(match, game);
+
+        if (match.verbose) {
+            pthread_mutex_lock(&match.lock);
+            printf("%s (%s): first bot %s in %d turns\n",
+                    match.mapNames[game.map], game.swapped ? "as 2" : "as 1",
+                    outcomeName(game.outcome), game.turns);
+            fflush(stdout);
+            pthread_mutex_unlock(&match.lock);
+        }
+    }
+}
+
+struct Tally
+{
+    int won, lost, drawn;
+
+    Tally() : won(0), lost(0), drawn(0) {}
+    void add(int outcome);
+    void print(const char *name) const;
+};
+
+void Tally::add(int outcome)
+{
+    if (outcome > 0)
+        ++won;
+    else if (outcome < 0)
+        ++lost;
+    else
+        ++drawn;
+}
+
+void Tally::print(const char *name) const
+{
+    int games = won + lost + drawn;
+    printf("%-24s %4d games  %4d won  %4d lost  %4d drawn  score %.3f\n",
+            name, games, won, lost, drawn,
+            games ? (won + 0.5 * drawn) / games : 0.0);
+}
+
+static void printStats(const char *command, const BotStats &stats)
+{
+    printf("%s: %ld moves, mean %.3fs, longest %.3fs, %d timeouts, %d bad moves\n",
+            command, stats.moves, stats.moves ? stats.total / stats.moves : 0.0,
+            stats.longest, stats.timeouts, stats.badMoves);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-j jobs] [-r rounds] [-t seconds] [-f seconds] [-v] bot1 bot2 maps...\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    // every game runs two bots, so by default there is a core for each
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = std::max(1L, cpus / 2);
+    int rounds = 1;
+
+    Match match;
+    match.moveLimit = 1.0;
+    match.firstMoveLimit = 3.0;
+    match.verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:r:t:f:v")) != -1) {
+        switch (opt) {
+            case 'j': jobs = atoi(optarg); break;
+            case 'r': rounds = atoi(optarg); break;
+            case 't': match.moveLimit = atof(optarg); break;
+            case 'f': match.firstMoveLimit = atof(optarg); break;
+            case 'v': match.verbose = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind < 3 || jobs < 1 || rounds < 1)
+        usage(argv[0]);
+
+    match.commands[0] = argv[optind];
+    match.commands[1] = argv[optind + 1];
+    for (int i = optind + 2; i < argc; ++i) {
+        Board board;
+        if (!board.load(argv[i]))
+            return 1;
+        match.mapNames.push_back(argv[i]);
+        match.maps.push_back(board);
+    }
+
+    // a bot that dies mid turn shouldn't take the referee with it
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t m = 0; m < match.maps.size(); ++m) {
+            for (int side = 0; side < 2; ++side) {
+                Game game;
+                game.map = m;
+                game.swapped = side == 1;
+                game.outcome = 0;
+                game.turns = 0;
+                match.games.push_back(game);
+            }
+        }
+    }
+    match.next = 0;
+    pthread_mutex_init(&match.lock, NULL);
+
+    double started = now();
+    ThreadPool pool(std::min(jobs, int(match.games.size())) - 1);
+    pool.start(&runGames, &match);
+    runGames(&match, -1);
+    pool.wait();
+    double elapsed = now() - started;
+
+    Tally total;
+    std::vector<Tally> byMap(match.maps.size());
+    BotStats stats[2];
+    for (size_t i = 0; i < match.games.size(); ++i) {
+        const Game &game = match.games[i];
+        total.add(game.outcome);
+        byMap[game.map].add(game.outcome);
+        stats[0].add(game.stats[0]);
+        stats[1].add(game.stats[1]);
+    }
+
+    printf("first bot: %s\nsecond bot: %s\n", match.commands[0], match.commands[1]);
+    for (size_t m = 0; m < match.maps.size(); ++m)
+        byMap[m].print(match.mapNames[m]);
+    total.print("total");
+    printStats("first bot", stats[0]);
+    printStats("second bot", stats[1]);
+    printf("%d games in %.1fs with %d jobs, %.0f games an hour\n",
+            int(match.games.size()), elapsed, jobs,
+            match.games.size() * 3600 / elapsed);
+
+    pthread_mutex_destroy(&match.lock);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#include "Scratch.h"
+#include <algorithm>
+
+static __thread Scratch *thread_scratch;
+
+Scratch::Scratch() :
+    visitGeneration(0), pathGeneration(0)
+{
+}
+
+void Scratch::startVisits(const Bitboard &board)
+{
+    if (visits.size() < size_t(board.cells())) {
+        visits.assign(board.cells(), 0);
+        visitGeneration = 0;
+    }
+
+    if (++visitGeneration == 0) {
+        // wrapped around, so old stamps could look current
+        std::fill(visits.begin(), visits.end(), 0);
+        visitGeneration = 1;
+    }
+}
+
+Scratch &threadScratch()
+{
+    if (!thread_scratch)
+        thread_scratch = new Scratch;
+    return *thread_scratch;
+}
+
+void resizeScratchBoard(Bitboard &board, const Bitboard &like)
+{
+    if (board.width() != like.width() || board.height() != like.height())
+        board = Bitboard(like.width(), like.height());
+}
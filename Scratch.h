@@ -0,0 +1,71 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "position.h"
+#include "Bitboard.h"
+#include "Chambers.h"
+
+// Working storage for the flood fills and territory kernels. Every search
+// thread gets its own, created the first time the thread asks for it and
+// kept for the life of the thread, so once it has grown to the size of the
+// board the fills never allocate. Nothing in here survives from one call to
+// the next, so a fill must not call another fill that uses the same member.
+struct Scratch
+{
+    // explicit stack for the depth first fills
+    std::vector<position> stack;
+
+    // visit stamps indexed by Bitboard::bitIndex; a square has been visited
+    // by the current fill when its stamp equals visitGeneration, so starting
+    // a new fill is O(1)
+    std::vector<uint32_t> visits;
+    uint32_t visitGeneration;
+
+    // squares reached by fillUnreachableSquares
+    Bitboard reached;
+
+    // territory fill state for bbVoronoi
+    Bitboard unclaimed, fronts[4], reachedSelf;
+
+    // chamber decomposition for countReachableSquares
+    ChamberTree chambers;
+
+    // the tablebase solver's memo, stamped like the visits: the longest
+    // path from cell through the squares in cells
+    struct PathMemo
+    {
+        uint64_t cells;
+        uint32_t stamp;
+        uint8_t cell;
+        uint8_t length;
+
+        PathMemo() : cells(0), stamp(0), cell(0), length(0) {}
+    };
+    std::vector<PathMemo> pathMemo;
+    uint32_t pathGeneration;
+
+    Scratch();
+
+    void startVisits(const Bitboard &board);
+    // marks a square visited, returning false if it already was
+    bool visit(int bit);
+};
+
+Scratch &threadScratch();
+
+// makes sure board has the given dimensions, reallocating only if it didn't
+void resizeScratchBoard(Bitboard &board, const Bitboard &like);
+
+inline
+bool Scratch::visit(int bit)
+{
+    if (visits[bit] == visitGeneration)
+        return false;
+    visits[bit] = visitGeneration;
+    return true;
+}
+
+#endif
@@ -0,0 +1,394 @@
+#include "Tablebase.h"
+#include "Scratch.h"
+#include "Deadline.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+Tablebase tablebase;
+
+// default number of entries, for a table that lives in memory
+static const size_t TABLEBASE_SIZE = 1024 * 1024;
+
+static const char MAGIC[8] = {'T', 'R', 'O', 'N', 'T', 'B', '1', '\n'};
+
+// What a slot's data holds: the length plus one, or HARD for a chamber the
+// solver gave up on, so that it isn't tried again.
+static const uint64_t HARD = 0xff;
+
+// the solver gives up on a chamber after this many positions
+static const long SOLVE_LIMIT = 200000;
+
+static const size_t MEMO_SIZE = 64 * 1024;
+
+Tablebase::Tablebase() :
+    buckets(NULL), mask(0), mapping(NULL), mappingSize(0)
+{
+    size_t count = TABLEBASE_SIZE / BUCKET_SLOTS;
+    size_t bytes = count * sizeof(Bucket);
+    void *m = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) {
+        perror("failed to map the tablebase");
+        exit(1);
+    }
+    map(m, bytes, count);
+}
+
+Tablebase::~Tablebase()
+{
+    unmap();
+}
+
+void Tablebase::map(void *m, size_t size, size_t count)
+{
+    unmap();
+    mapping = m;
+    mappingSize = size;
+    mask = count - 1;
+
+    // a file starts with its header, an anonymous table with its buckets
+    if (size > count * sizeof(Bucket))
+        buckets = reinterpret_cast<Bucket *>(static_cast<char *>(m) + sizeof(Header));
+    else
+        buckets = static_cast<Bucket *>(m);
+}
+
+void Tablebase::unmap()
+{
+    if (mapping)
+        munmap(mapping, mappingSize);
+    mapping = NULL;
+}
+
+bool Tablebase::open(const char *path, size_t entries)
+{
+    size_t count = 1;
+    while (count * 2 * BUCKET_SLOTS <= entries)
+        count *= 2;
+
+    int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+
+    bool fresh = st.st_size == 0;
+    Header header;
+    if (fresh) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.buckets = count;
+        // the buckets read as empty until they are written
+        if (pwrite(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+                ftruncate(fd, sizeof(header) + count * sizeof(Bucket)) < 0) {
+            perror(path);
+            close(fd);
+            return false;
+        }
+    } else {
+        if (pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+                memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+                header.buckets == 0 || (header.buckets & (header.buckets - 1)) ||
+                size_t(st.st_size) != sizeof(header) + header.buckets * sizeof(Bucket)) {
+            fprintf(stderr, "%s isn't a tablebase, keeping it in memory\n", path);
+            close(fd);
+            return false;
+        }
+        count = header.buckets;
+    }
+
+    size_t size = sizeof(header) + count * sizeof(Bucket);
+    void *m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+
+    map(m, size, count);
+    return true;
+}
+
+bool Tablebase::get(uint64_t key, uint64_t *data) const
+{
+    const Bucket &bucket = buckets[key & mask];
+
+    for (int i = 0; i < BUCKET_SLOTS; ++i) {
+        const Slot &slot = bucket.slots[i];
+        uint64_t check = __atomic_load_n(&slot.check, __ATOMIC_RELAXED);
+        uint64_t d = __atomic_load_n(&slot.data, __ATOMIC_RELAXED);
+
+        if (d && (check ^ d) == key) {
+            *data = d;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Entries are never wrong, so any of them can go; an empty slot is used if
+// there is one, and otherwise the key picks which to replace.
+void Tablebase::set(uint64_t key, uint64_t data)
+{
+    Bucket &bucket = buckets[key & mask];
+
+    Slot *victim = &bucket.slots[(key >> 60) % BUCKET_SLOTS];
+    for (int i = 0; i < BUCKET_SLOTS; ++i) {
+        Slot &slot = bucket.slots[i];
+        if (__atomic_load_n(&slot.data, __ATOMIC_RELAXED) == 0) {
+            victim = &slot;
+            break;
+        }
+    }
+
+    __atomic_store_n(&victim->check, key ^ data, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->data, data, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t mixSquare(int x, int y, uint64_t salt)
+{
+    // splitmix64's finaliser
+    uint64_t z = (uint64_t(uint32_t(x)) << 32 | uint32_t(y)) + salt;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static const uint64_t SQUARE_SALT = 0x9e3779b97f4a7c15ULL;
+static const uint64_t ENTRY_SALT = 0x632be59bd9b4e019ULL;
+
+// The key is a sum over the chamber's squares, so the order they were
+// found in doesn't matter, taken in each of the eight orientations with the
+// bounding box moved to the origin; the smallest of the eight is the key.
+static uint64_t chamberKey(const position *cells, int n, position entry)
+{
+    int minX = entry.x, maxX = entry.x, minY = entry.y, maxY = entry.y;
+    for (int i = 0; i < n; ++i) {
+        minX = std::min(minX, cells[i].x);
+        maxX = std::max(maxX, cells[i].x);
+        minY = std::min(minY, cells[i].y);
+        maxY = std::max(maxY, cells[i].y);
+    }
+
+    uint64_t sums[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (int i = -1; i < n; ++i) {
+        position p = i < 0 ? entry : cells[i];
+        uint64_t salt = i < 0 ? ENTRY_SALT : SQUARE_SALT;
+        int x = p.x - minX, fx = maxX - p.x;
+        int y = p.y - minY, fy = maxY - p.y;
+
+        sums[0] += mixSquare(x, y, salt);
+        sums[1] += mixSquare(fx, y, salt);
+        sums[2] += mixSquare(x, fy, salt);
+        sums[3] += mixSquare(fx, fy, salt);
+        sums[4] += mixSquare(y, x, salt);
+        sums[5] += mixSquare(y, fx, salt);
+        sums[6] += mixSquare(fy, x, salt);
+        sums[7] += mixSquare(fy, fx, salt);
+    }
+
+    return *std::min_element(sums, sums + 8);
+}
+
+// Longest path search over a chamber of at most 64 squares, each a bit of
+// a mask. The positions are memoised on the squares still reachable and
+// the square the player is on, which is all that matters to what is left.
+struct ChamberSolver
+{
+    uint64_t adjacent[Tablebase::MAX_CELLS];
+    uint64_t colour; // the squares of one colour of the checkerboard
+
+    Scratch *scratch;
+    Deadline *deadline;
+    long nodes;
+    bool aborted;
+
+    uint64_t reachable(uint64_t cells, uint64_t from) const;
+    int longest(uint64_t cells, int cur);
+};
+
+inline uint64_t ChamberSolver::reachable(uint64_t cells, uint64_t from) const
+{
+    uint64_t reach = from & cells;
+    uint64_t todo = reach;
+    while (todo) {
+        int i = __builtin_ctzll(todo);
+        todo &= todo - 1;
+        uint64_t next = adjacent[i] & cells & ~reach;
+        reach |= next;
+        todo |= next;
+    }
+    return reach;
+}
+
+// the most moves from cur, through squares in cells (which doesn't include
+// cur)
+int ChamberSolver::longest(uint64_t cells, int cur)
+{
+    uint64_t reach = reachable(cells, adjacent[cur]);
+    if (!reach)
+        return 0;
+
+    if (++nodes > SOLVE_LIMIT || deadline->expired()) {
+        aborted = true;
+        return 0;
+    }
+
+    Scratch::PathMemo &memo = scratch->pathMemo[
+        ((reach ^ uint64_t(cur) << 58) * 0x9e3779b97f4a7c15ULL) >> 48 & (MEMO_SIZE - 1)];
+    if (memo.stamp == scratch->pathGeneration && memo.cells == reach &&
+            memo.cell == cur)
+        return memo.length;
+
+    // a path alternates colours, so it can only use one more square of the
+    // other colour than of cur's
+    uint64_t same = colour >> cur & 1 ? colour : ~colour;
+    int sameCount = __builtin_popcountll(reach & same);
+    int otherCount = __builtin_popcountll(reach) - sameCount;
+    int bound = otherCount > sameCount ? 2 * sameCount + 1 : 2 * otherCount;
+
+    // the squares with the fewest ways on go first, which finds the long
+    // paths (and so the bound) sooner
+    int moves[4], ways[4], cnt = 0;
+    for (uint64_t m = adjacent[cur] & reach; m; m &= m - 1) {
+        int i = __builtin_ctzll(m);
+        int w = __builtin_popcountll(adjacent[i] & reach);
+        int j = cnt++;
+        for (; j > 0 && ways[j - 1] > w; --j) {
+            moves[j] = moves[j - 1];
+            ways[j] = ways[j - 1];
+        }
+        moves[j] = i;
+        ways[j] = w;
+    }
+
+    int best = 0;
+    for (int i = 0; i < cnt && best < bound; ++i) {
+        int len = 1 + longest(reach & ~(uint64_t(1) << moves[i]), moves[i]);
+        if (aborted)
+            return 0;
+        best = std::max(best, len);
+    }
+
+    memo.cells = reach;
+    memo.stamp = scratch->pathGeneration;
+    memo.cell = cur;
+    memo.length = best;
+    return best;
+}
+
+static inline bool isNeighbour(position a, position b)
+{
+    return std::abs(a.x - b.x) + std::abs(a.y - b.y) == 1;
+}
+
+static inline void visitChamber(const Bitboard &board, Scratch &scratch,
+        position pos, position *cells, int &n)
+{
+    if (!board.get(pos) && scratch.visit(board.bitIndex(pos))) {
+        if (n < Tablebase::MAX_CELLS)
+            cells[n] = pos;
+        ++n;
+    }
+}
+
+bool Tablebase::longestPath(const Bitboard &board, position pos, int *length,
+        Deadline &deadline)
+{
+    Scratch &scratch = threadScratch();
+
+    // the chamber is whatever the player can reach, given up on as soon as
+    // it is too big
+    position cells[MAX_CELLS];
+    int n = 0;
+    scratch.startVisits(board);
+    scratch.visit(board.bitIndex(pos));
+    visitChamber(board, scratch, pos.north(), cells, n);
+    visitChamber(board, scratch, pos.south(), cells, n);
+    visitChamber(board, scratch, pos.west(), cells, n);
+    visitChamber(board, scratch, pos.east(), cells, n);
+    for (int i = 0; i < n && n <= MAX_CELLS; ++i) {
+        position p = cells[i];
+        visitChamber(board, scratch, p.north(), cells, n);
+        visitChamber(board, scratch, p.south(), cells, n);
+        visitChamber(board, scratch, p.west(), cells, n);
+        visitChamber(board, scratch, p.east(), cells, n);
+    }
+    if (n > MAX_CELLS)
+        return false;
+    if (n <= 1) {
+        *length = n;
+        return true;
+    }
+
+    uint64_t key = chamberKey(cells, n, pos);
+    uint64_t data;
+    if (get(key, &data)) {
+        if (data == HARD)
+            return false;
+        *length = data - 1;
+        return true;
+    }
+
+    ChamberSolver solver;
+    uint64_t entry = 0;
+    solver.colour = 0;
+    for (int i = 0; i < n; ++i) {
+        solver.adjacent[i] = 0;
+        for (int j = 0; j < n; ++j) {
+            if (isNeighbour(cells[i], cells[j]))
+                solver.adjacent[i] |= uint64_t(1) << j;
+        }
+        if ((cells[i].x + cells[i].y) & 1)
+            solver.colour |= uint64_t(1) << i;
+        if (isNeighbour(cells[i], pos))
+            entry |= uint64_t(1) << i;
+    }
+
+    if (scratch.pathMemo.size() < MEMO_SIZE) {
+        scratch.pathMemo.assign(MEMO_SIZE, Scratch::PathMemo());
+        scratch.pathGeneration = 0;
+    }
+    if (++scratch.pathGeneration == 0) {
+        std::fill(scratch.pathMemo.begin(), scratch.pathMemo.end(), Scratch::PathMemo());
+        scratch.pathGeneration = 1;
+    }
+    solver.scratch = &scratch;
+    solver.deadline = &deadline;
+    solver.nodes = 0;
+    solver.aborted = false;
+
+    uint64_t all = n == 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+    int best = 0;
+    for (uint64_t m = entry; m && !solver.aborted; m &= m - 1) {
+        int i = __builtin_ctzll(m);
+        best = std::max(best, 1 + solver.longest(all & ~(uint64_t(1) << i), i));
+    }
+
+    if (solver.aborted) {
+        // running out of time says nothing about the chamber
+        if (solver.nodes > SOLVE_LIMIT)
+            set(key, HARD);
+        return false;
+    }
+
+    set(key, best + 1);
+    *length = best;
+    return true;
+}
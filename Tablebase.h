@@ -0,0 +1,84 @@
+#ifndef TABLEBASE_H
+#define TABLEBASE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "position.h"
+#include "Bitboard.h"
+
+class Deadline;
+
+// Exact longest paths for players shut in small chambers, which is where
+// the reachable square bound is furthest off and an exact answer is cheap.
+// A chamber is keyed by its shape and the square the player enters it from,
+// up to rotation and reflection, so the same pocket found anywhere on any
+// board shares an entry.
+//
+// Entries are solved the first time they are asked for. The table can be
+// backed by a file, mapped shared so that whatever is solved is written
+// back and is there for the next game; without one it only lasts as long
+// as the process. Slots are read and written without locking, the same as
+// the transposition table's, and since an entry only depends on the shape
+// of its chamber one table is shared by every engine in the process.
+class Tablebase
+{
+    public:
+        // largest chamber that is solved
+        static const int MAX_CELLS = 64;
+
+        Tablebase();
+        ~Tablebase();
+
+        // Maps the table from path, creating the file with room for the
+        // given number of entries if it isn't there. An existing file keeps
+        // its own size. Returns false, leaving the table in memory only, if
+        // the file can't be used.
+        bool open(const char *path, size_t entries);
+
+        // Sets *length to the most moves a player at pos can still make, if
+        // it can reach at most MAX_CELLS squares and the chamber could be
+        // solved in reasonable time. Solving gives up if deadline expires.
+        bool longestPath(const Bitboard &board, position pos, int *length,
+                Deadline &deadline);
+
+    private:
+        struct Slot
+        {
+            uint64_t check;
+            uint64_t data;
+        };
+
+        enum { BUCKET_SLOTS = 4 };
+
+        struct Bucket
+        {
+            Slot slots[BUCKET_SLOTS];
+        } __attribute__((aligned(64)));
+
+        // what starts a mapped file, padded out to a bucket
+        struct Header
+        {
+            char magic[8];
+            uint64_t buckets;
+            char unused[48];
+        };
+
+        void map(void *mapping, size_t mappingSize, size_t count);
+        void unmap();
+
+        bool get(uint64_t key, uint64_t *data) const;
+        void set(uint64_t key, uint64_t data);
+
+        Bucket *buckets;
+        size_t mask; // buckets - 1
+        void *mapping;
+        size_t mappingSize;
+
+        Tablebase(const Tablebase &);
+        Tablebase &operator=(const Tablebase &);
+};
+
+extern Tablebase tablebase;
+
+#endif
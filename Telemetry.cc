@@ -0,0 +1,112 @@
+#include "Telemetry.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+SearchStats::SearchStats()
+{
+    clear();
+}
+
+void SearchStats::clear()
+{
+    nodes = leafEvals = 0;
+    ttProbes = ttHits = ttCollisions = 0;
+    cutoffs = firstMoveCutoffs = researches = 0;
+    heuristicTicks = fillTicks = expandTicks = 0;
+}
+
+void SearchStats::add(const SearchStats &other)
+{
+    nodes += other.nodes;
+    leafEvals += other.leafEvals;
+    ttProbes += other.ttProbes;
+    ttHits += other.ttHits;
+    ttCollisions += other.ttCollisions;
+    cutoffs += other.cutoffs;
+    firstMoveCutoffs += other.firstMoveCutoffs;
+    researches += other.researches;
+    heuristicTicks += other.heuristicTicks;
+    fillTicks += other.fillTicks;
+    expandTicks += other.expandTicks;
+}
+
+TelemetryLog::TelemetryLog() :
+    fd(-1), owned(false)
+{
+}
+
+TelemetryLog::~TelemetryLog()
+{
+    if (owned)
+        close(fd);
+}
+
+bool TelemetryLog::open(const char *target)
+{
+    if (owned)
+        close(fd);
+    fd = -1;
+    owned = false;
+
+    if (strncmp(target, "fd:", 3) == 0) {
+        char *end;
+        long n = strtol(target + 3, &end, 10);
+        if (end == target + 3 || *end || n < 0 || fcntl(n, F_GETFD) < 0) {
+            fprintf(stderr, "%s: not an open descriptor\n", target);
+            return false;
+        }
+        fd = n;
+        return true;
+    }
+
+    fd = ::open(target, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(target);
+        return false;
+    }
+    owned = true;
+    return true;
+}
+
+void TelemetryLog::write(const TurnRecord &turn)
+{
+    if (fd < 0)
+        return;
+
+    // the tick rate is found from the turn as a whole
+    double elapsedMs = turn.elapsed * 1000;
+    double msPerTick = turn.ticks ? elapsedMs / turn.ticks : 0;
+    const SearchStats &s = turn.stats;
+
+    char line[1024];
+    int len = snprintf(line, sizeof(line),
+            "{\"pid\":%d,\"game\":%d,\"turn\":%d,\"decider\":\"%s\","
+            "\"move\":\"%s\",\"depth\":%d,\"threads\":%d,"
+            "\"nodes\":%ld,\"leaf_evals\":%ld,\"tt_probes\":%ld,"
+            "\"tt_hits\":%ld,\"tt_collisions\":%ld,\"cutoffs\":%ld,"
+            "\"first_move_cutoffs\":%ld,\"researches\":%ld,"
+            "\"heuristic_ms\":%.3f,\"fill_ms\":%.3f,\"expand_ms\":%.3f,"
+            "\"elapsed_ms\":%.3f,\"remaining_ms\":%.3f}\n",
+            int(getpid()), turn.game, turn.turn,
+            turn.isolated ? "isolated" : "minimax", dirToString(turn.move),
+            turn.depth, turn.threads,
+            s.nodes, s.leafEvals, s.ttProbes, s.ttHits, s.ttCollisions,
+            s.cutoffs, s.firstMoveCutoffs, s.researches,
+            s.heuristicTicks * msPerTick,
+            s.fillTicks * msPerTick,
+            s.expandTicks * msPerTick,
+            elapsedMs, turn.remaining * 1000);
+    if (len <= 0 || len >= int(sizeof(line)))
+        return;
+
+    // finishing a short write could land the rest after another writer's
+    // line, so what didn't fit is dropped
+    while (::write(fd, line, len) < 0 && errno == EINTR)
+        ;
+}
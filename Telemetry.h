@@ -0,0 +1,131 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+#include "Map.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TELEMETRY_TSC 1
+#else
+#include <time.h>
+#endif
+
+// What a minimax search counts as it goes. Each thread's tree keeps its
+// own, which are added up once the threads are done, so nothing is shared
+// while searching. The counts are only increments and are always kept; the
+// times cost a clock read each, so a tree only keeps them if asked to.
+struct SearchStats
+{
+    long nodes;
+    long leafEvals; // heuristics worked out, rather than found in the table
+    long ttProbes;
+    long ttHits;
+    long ttCollisions; // misses in a bucket full of other positions
+    long cutoffs; // beta cutoffs
+    long firstMoveCutoffs; // cutoffs by the first move tried
+    long researches; // null window searches that failed high
+
+    // in telemetryTicks(), summed over threads; the heuristic's time
+    // includes the fills it does
+    uint64_t heuristicTicks;
+    uint64_t fillTicks; // territory and reachable square fills
+    uint64_t expandTicks; // building and ordering nodes' children
+
+    SearchStats();
+
+    void clear();
+    void add(const SearchStats &other);
+};
+
+// A cheap clock for timing parts of the search: the time stamp counter on
+// x86, nanoseconds elsewhere. Ticks are turned into time by going by how
+// many passed over the whole turn.
+inline uint64_t telemetryTicks()
+{
+#ifdef TELEMETRY_TSC
+    return __rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// Adds the ticks from construction to destruction to total, if on is set.
+class StatTimer
+{
+    public:
+        StatTimer(bool on, uint64_t &total);
+        ~StatTimer();
+
+    private:
+        uint64_t *total;
+        uint64_t start;
+};
+
+inline
+StatTimer::StatTimer(bool on, uint64_t &total) :
+    total(on ? &total : NULL), start(on ? telemetryTicks() : 0)
+{
+}
+
+inline
+StatTimer::~StatTimer()
+{
+    if (total)
+        *total += telemetryTicks() - start;
+}
+
+// everything said about one turn
+struct TurnRecord
+{
+    int game; // counted from 1 by each engine
+    int turn; // counted from 1 each game
+    bool isolated; // which decider was used
+    Direction move;
+    int depth; // the last depth the minimax search finished, or 0
+    int threads;
+
+    // the search's counts, all threads together; the isolated search
+    // counts its nodes, its memo's probes and the time in its fills
+    SearchStats stats;
+    uint64_t ticks; // over the whole turn
+
+    double elapsed; // seconds
+    double remaining; // of the turn's budget, after the margin
+};
+
+// Where per turn records go, one JSON object a line. Each line is written
+// with a single write(), so several bots can append to the same file.
+class TelemetryLog
+{
+    public:
+        TelemetryLog();
+        ~TelemetryLog();
+
+        // Appends to the file target, or writes to descriptor N if target
+        // is "fd:N" (which is left open when the log is done with it).
+        // Returns false, leaving the log closed, if that can't be done.
+        bool open(const char *target);
+
+        bool isOpen() const;
+
+        void write(const TurnRecord &turn);
+
+    private:
+        int fd;
+        bool owned;
+
+        TelemetryLog(const TelemetryLog &);
+        TelemetryLog &operator=(const TelemetryLog &);
+};
+
+inline
+bool TelemetryLog::isOpen() const
+{
+    return fd >= 0;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include "ThreadPool.h"
+#include <cstdio>
+#include <signal.h>
+
+struct HelperStart
+{
+    ThreadPool *pool;
+    int helper;
+};
+
+ThreadPool::ThreadPool(int helpers) :
+    task(NULL), taskArg(NULL), generation(0), running(0), quit(false)
+{
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&wake, NULL);
+    pthread_cond_init(&done, NULL);
+
+    // the helpers inherit this mask, so signals meant for the process are
+    // handled by the main thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    for (int i = 0; i < helpers; ++i) {
+        HelperStart *start = new HelperStart;
+        start->pool = this;
+        start->helper = i;
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &threadMain, start) != 0) {
+            perror("failed to start search thread");
+            delete start;
+            break;
+        }
+        threads.push_back(thread);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+ThreadPool::~ThreadPool()
+{
+    pthread_mutex_lock(&lock);
+    quit = true;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    for (size_t i = 0; i < threads.size(); ++i)
+        pthread_join(threads[i], NULL);
+
+    pthread_cond_destroy(&done);
+    pthread_cond_destroy(&wake);
+    pthread_mutex_destroy(&lock);
+}
+
+void *ThreadPool::threadMain(void *arg)
+{
+    HelperStart start = *static_cast<HelperStart *>(arg);
+    delete static_cast<HelperStart *>(arg);
+
+    start.pool->helperLoop(start.helper);
+    return NULL;
+}
+
+void ThreadPool::helperLoop(int helper)
+{
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (!quit && generation == seen)
+            pthread_cond_wait(&wake, &lock);
+        if (quit)
+            break;
+
+        seen = generation;
+        Task t = task;
+        void *arg = taskArg;
+        pthread_mutex_unlock(&lock);
+
+        t(arg, helper);
+
+        pthread_mutex_lock(&lock);
+        if (--running == 0)
+            pthread_cond_broadcast(&done);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void ThreadPool::start(Task t, void *arg)
+{
+    if (threads.empty())
+        return;
+
+    pthread_mutex_lock(&lock);
+    task = t;
+    taskArg = arg;
+    running = threads.size();
+    ++generation;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+void ThreadPool::wait()
+{
+    pthread_mutex_lock(&lock);
+    while (running > 0)
+        pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,52 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <pthread.h>
+
+// A fixed set of helper threads that the searches hand work to. The threads
+// are created once and live as long as the pool, so anything they keep per
+// thread (like their Scratch) is only ever allocated once.
+class ThreadPool
+{
+    public:
+        typedef void (*Task)(void *arg, int helper);
+
+        explicit ThreadPool(int helpers);
+        ~ThreadPool();
+
+        int size() const;
+
+        // Runs task(arg, i) on every helper i and returns straight away, so
+        // the calling thread can work alongside them. Must be followed by a
+        // call to wait() before the next start().
+        void start(Task task, void *arg);
+
+        // blocks until every helper has returned from the current task
+        void wait();
+
+    private:
+        static void *threadMain(void *arg);
+        void helperLoop(int helper);
+
+        std::vector<pthread_t> threads;
+        pthread_mutex_t lock;
+        pthread_cond_t wake, done;
+
+        Task task;
+        void *taskArg;
+        unsigned generation;
+        int running;
+        bool quit;
+
+        ThreadPool(const ThreadPool &);
+        ThreadPool &operator=(const ThreadPool &);
+};
+
+inline
+int ThreadPool::size() const
+{
+    return threads.size();
+}
+
+#endif
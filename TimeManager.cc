@@ -0,0 +1,84 @@
+#include "TimeManager.h"
+#include "Deadline.h"
+
+#include <algorithm>
+
+// once the best move has held for this many depths, and this much of the
+// budget is used, it is taken as settled
+static const int STABLE_DEPTHS = 4;
+static const double STABLE_FRACTION = 0.6;
+
+TimeManager::TimeManager(Deadline &deadline) :
+    deadline(deadline), margin(0.05), budget(0), branching(4),
+    lastNodes(0), turnNodes(0), lastMove(-1), stableDepths(0)
+{
+    start.tv_sec = 0;
+    start.tv_nsec = 0;
+}
+
+void TimeManager::setMargin(double seconds)
+{
+    margin = seconds;
+}
+
+void TimeManager::startTurn(double allowance)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    budget = std::max(0.0, allowance - margin);
+    deadline.start(budget);
+
+    lastNodes = 0;
+    turnNodes = 0;
+    lastMove = -1;
+    stableDepths = 0;
+}
+
+double TimeManager::elapsed() const
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+double TimeManager::remaining() const
+{
+    return std::max(0.0, budget - elapsed());
+}
+
+void TimeManager::depthDone(int bestMove, long nodes)
+{
+    // the first depth of a turn is often mostly transposition table hits,
+    // so a single step says little; smoothing keeps it from swinging the
+    // estimate too far
+    if (lastNodes > 0 && nodes > 0) {
+        double step = std::min(8.0, std::max(1.2, double(nodes) / lastNodes));
+        branching = 0.7 * branching + 0.3 * step;
+    }
+
+    if (bestMove == lastMove)
+        ++stableDepths;
+    else
+        stableDepths = 0;
+
+    lastMove = bestMove;
+    lastNodes = nodes;
+    turnNodes += nodes;
+}
+
+bool TimeManager::startNextDepth() const
+{
+    double used = elapsed();
+    if (used >= budget)
+        return false;
+
+    if (stableDepths >= STABLE_DEPTHS && used >= STABLE_FRACTION * budget)
+        return false;
+
+    if (turnNodes == 0 || used <= 0)
+        return true;
+
+    double nodeRate = turnNodes / used;
+    double expected = lastNodes * branching / nodeRate;
+    return used + expected <= budget;
+}
@@ -0,0 +1,53 @@
+#ifndef TIME_MANAGER_H
+#define TIME_MANAGER_H
+
+#include <time.h>
+
+class Deadline;
+
+// Decides how much of a turn the minimax search uses. The hard limit is
+// the engine's allowance less a safety margin for the engine's latency,
+// and is enforced through the engine's deadline. Within that, another
+// deepening step is only started if it is expected to finish, going by how
+// the node counts have been growing from one depth to the next and how
+// fast nodes are being searched this turn, and the search stops early once
+// the best move has stayed the same for a while.
+class TimeManager
+{
+    public:
+        // deadline is started at the top of each turn
+        explicit TimeManager(Deadline &deadline);
+
+        void setMargin(double seconds);
+
+        // starts the clock (and the deadline) for a turn the engine
+        // gives allowance seconds for
+        void startTurn(double allowance);
+
+        double elapsed() const;
+
+        // what is left of this turn's budget
+        double remaining() const;
+
+        // called after each finished depth with the best move and the
+        // nodes searched for it
+        void depthDone(int bestMove, long nodes);
+
+        // whether the next depth should be started
+        bool startNextDepth() const;
+
+    private:
+        Deadline &deadline;
+        double margin;
+        timespec start;
+        double budget;
+
+        // nodes per depth step, smoothed over this turn and the ones before
+        double branching;
+
+        long lastNodes, turnNodes;
+        int lastMove;
+        int stableDepths;
+};
+
+#endif
@@ -0,0 +1,538 @@
+#include "Voronoi.h"
+#include "Scratch.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VORONOI_X86 1
+#endif
+
+// The rows of a bitboard are laid out back to back with clear padding
+// columns between them, so an east/west shift is a one-bit shift of the whole
+// array and north/south is a shift by one row of words (see bbNeighbours).
+
+static inline void claimWord(uint64_t a, uint64_t b, uint64_t *unclaimed,
+        int i, int *newLo, int *newHi, int *ownSelf, int *ownEnemy)
+{
+    if (a | b) {
+        unclaimed[i] &= ~(a | b);
+        *ownSelf += __builtin_popcountll(a & ~b);
+        *ownEnemy += __builtin_popcountll(b & ~a);
+        if (*newLo > i)
+            *newLo = i;
+        *newHi = i + 1;
+    }
+}
+
+static inline uint64_t spreadWord(const uint64_t *in, int i, int stride)
+{
+    return (in[i] << 1) | (in[i - 1] >> 63) | (in[i] >> 1) | (in[i + 1] << 63) |
+        in[i - stride] | in[i + stride];
+}
+
+void voronoiStepScalar(const uint64_t *inSelf, const uint64_t *inEnemy,
+        uint64_t *outSelf, uint64_t *outEnemy, uint64_t *unclaimed,
+        int stride, int end, int *lo, int *hi, int *ownSelf, int *ownEnemy)
+{
+    int from = std::max(stride, *lo - stride);
+    int to = std::min(end, *hi + stride);
+    int newLo = to, newHi = from;
+
+    for (int i = from; i < to; ++i) {
+        uint64_t a = spreadWord(inSelf, i, stride) & unclaimed[i];
+        uint64_t b = spreadWord(inEnemy, i, stride) & unclaimed[i];
+        outSelf[i] = a;
+        outEnemy[i] = b;
+        claimWord(a, b, unclaimed, i, &newLo, &newHi, ownSelf, ownEnemy);
+    }
+
+    *lo = newLo;
+    *hi = newHi;
+}
+
+#ifdef VORONOI_X86
+
+__attribute__((target("sse2")))
+static inline __m128i spreadSSE2(const uint64_t *in, int i, int stride)
+{
+    __m128i c = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i w = _mm_loadu_si128((const __m128i *)(in + i - 1));
+    __m128i e = _mm_loadu_si128((const __m128i *)(in + i + 1));
+    __m128i n = _mm_loadu_si128((const __m128i *)(in + i - stride));
+    __m128i s = _mm_loadu_si128((const __m128i *)(in + i + stride));
+
+    __m128i r = _mm_or_si128(_mm_slli_epi64(c, 1), _mm_srli_epi64(w, 63));
+    r = _mm_or_si128(r, _mm_srli_epi64(c, 1));
+    r = _mm_or_si128(r, _mm_slli_epi64(e, 63));
+    return _mm_or_si128(r, _mm_or_si128(n, s));
+}
+
+__attribute__((target("sse2")))
+static void stepSSE2(const uint64_t *inSelf, const uint64_t *inEnemy,
+        uint64_t *outSelf, uint64_t *outEnemy, uint64_t *unclaimed,
+        int stride, int end, int *lo, int *hi, int *ownSelf, int *ownEnemy)
+{
+    int from = std::max(stride, *lo - stride);
+    int to = std::min(end, *hi + stride);
+    int newLo = to, newHi = from;
+
+    int i = from;
+    for (; i + 2 <= to; i += 2) {
+        __m128i u = _mm_loadu_si128((const __m128i *)(unclaimed + i));
+        __m128i a = _mm_and_si128(spreadSSE2(inSelf, i, stride), u);
+        __m128i b = _mm_and_si128(spreadSSE2(inEnemy, i, stride), u);
+        _mm_storeu_si128((__m128i *)(outSelf + i), a);
+        _mm_storeu_si128((__m128i *)(outEnemy + i), b);
+
+        for (int k = 0; k < 2; ++k)
+            claimWord(outSelf[i + k], outEnemy[i + k], unclaimed, i + k,
+                    &newLo, &newHi, ownSelf, ownEnemy);
+    }
+    for (; i < to; ++i) {
+        uint64_t a = spreadWord(inSelf, i, stride) & unclaimed[i];
+        uint64_t b = spreadWord(inEnemy, i, stride) & unclaimed[i];
+        outSelf[i] = a;
+        outEnemy[i] = b;
+        claimWord(a, b, unclaimed, i, &newLo, &newHi, ownSelf, ownEnemy);
+    }
+
+    *lo = newLo;
+    *hi = newHi;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i spreadAVX2(const uint64_t *in, int i, int stride)
+{
+    __m256i c = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i w = _mm256_loadu_si256((const __m256i *)(in + i - 1));
+    __m256i e = _mm256_loadu_si256((const __m256i *)(in + i + 1));
+    __m256i n = _mm256_loadu_si256((const __m256i *)(in + i - stride));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(in + i + stride));
+
+    __m256i r = _mm256_or_si256(_mm256_slli_epi64(c, 1), _mm256_srli_epi64(w, 63));
+    r = _mm256_or_si256(r, _mm256_srli_epi64(c, 1));
+    r = _mm256_or_si256(r, _mm256_slli_epi64(e, 63));
+    return _mm256_or_si256(r, _mm256_or_si256(n, s));
+}
+
+__attribute__((target("avx2,popcnt")))
+static void stepAVX2(const uint64_t *inSelf, const uint64_t *inEnemy,
+        uint64_t *outSelf, uint64_t *outEnemy, uint64_t *unclaimed,
+        int stride, int end, int *lo, int *hi, int *ownSelf, int *ownEnemy)
+{
+    int from = std::max(stride, *lo - stride);
+    int to = std::min(end, *hi + stride);
+    int newLo = to, newHi = from;
+
+    int i = from;
+    for (; i + 4 <= to; i += 4) {
+        __m256i u = _mm256_loadu_si256((const __m256i *)(unclaimed + i));
+        __m256i a = _mm256_and_si256(spreadAVX2(inSelf, i, stride), u);
+        __m256i b = _mm256_and_si256(spreadAVX2(inEnemy, i, stride), u);
+        _mm256_storeu_si256((__m256i *)(outSelf + i), a);
+        _mm256_storeu_si256((__m256i *)(outEnemy + i), b);
+
+        if (_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b)))
+            continue;
+
+        for (int k = 0; k < 4; ++k)
+            claimWord(outSelf[i + k], outEnemy[i + k], unclaimed, i + k,
+                    &newLo, &newHi, ownSelf, ownEnemy);
+    }
+    for (; i < to; ++i) {
+        uint64_t a = spreadWord(inSelf, i, stride) & unclaimed[i];
+        uint64_t b = spreadWord(inEnemy, i, stride) & unclaimed[i];
+        outSelf[i] = a;
+        outEnemy[i] = b;
+        claimWord(a, b, unclaimed, i, &newLo, &newHi, ownSelf, ownEnemy);
+    }
+
+    *lo = newLo;
+    *hi = newHi;
+}
+
+// these run from static initializers, before the cpu model is set up
+static VoronoiStep detectSSE2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2") ? stepSSE2 : NULL;
+}
+
+static VoronoiStep detectAVX2()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        return stepAVX2;
+    return NULL;
+}
+
+const VoronoiStep voronoiStepSSE2 = detectSSE2();
+const VoronoiStep voronoiStepAVX2 = detectAVX2();
+
+#else
+
+const VoronoiStep voronoiStepSSE2 = NULL;
+const VoronoiStep voronoiStepAVX2 = NULL;
+
+#endif
+
+VoronoiStep voronoiBestStep()
+{
+    if (voronoiStepAVX2)
+        return voronoiStepAVX2;
+    if (voronoiStepSSE2)
+        return voronoiStepSSE2;
+    return voronoiStepScalar;
+}
+
+static inline int wordIndex(const Bitboard &board, position pos)
+{
+    return board.bitIndex(pos) >> 6;
+}
+
+int bbVoronoi(const Bitboard &walls, position self, position enemy,
+        bool *connected, VoronoiStep step)
+{
+    Scratch &scratch = threadScratch();
+    Bitboard &unclaimed = scratch.unclaimed;
+    Bitboard &reached = scratch.reachedSelf;
+    Bitboard *front = scratch.fronts;
+
+    resizeScratchBoard(unclaimed, walls);
+    for (int i = 0; i < 4; ++i) {
+        resizeScratchBoard(front[i], walls);
+        front[i].clear();
+    }
+    if (connected) {
+        resizeScratchBoard(reached, walls);
+        reached.clear();
+        reached.set(self);
+    }
+
+    // walls has its padding set, so the complement has it clear
+    const uint64_t *w = walls.words();
+    uint64_t *u = unclaimed.words();
+    for (int i = 0; i < walls.size(); ++i)
+        u[i] = ~w[i];
+    unclaimed.reset(self);
+    unclaimed.reset(enemy);
+
+    Bitboard *inSelf = &front[0], *inEnemy = &front[1];
+    Bitboard *outSelf = &front[2], *outEnemy = &front[3];
+    inSelf->set(self);
+    inEnemy->set(enemy);
+
+    const int stride = walls.stride();
+    const int end = (walls.height() + 1) * stride;
+    int lo = std::min(wordIndex(walls, self), wordIndex(walls, enemy));
+    int hi = std::max(wordIndex(walls, self), wordIndex(walls, enemy)) + 1;
+    int ownSelf = 0, ownEnemy = 0;
+
+    while (lo < hi) {
+        int oldLo = lo, oldHi = hi;
+        step(inSelf->words(), inEnemy->words(), outSelf->words(),
+                outEnemy->words(), u, stride, end, &lo, &hi,
+                &ownSelf, &ownEnemy);
+
+        // the old fronts become the next outputs, which must start out zero
+        std::fill(inSelf->words() + oldLo, inSelf->words() + oldHi, 0);
+        std::fill(inEnemy->words() + oldLo, inEnemy->words() + oldHi, 0);
+        std::swap(inSelf, outSelf);
+        std::swap(inEnemy, outEnemy);
+
+        if (connected) {
+            uint64_t *r = reached.words();
+            const uint64_t *f = inSelf->words();
+            for (int i = lo; i < hi; ++i)
+                r[i] |= f[i];
+        }
+    }
+
+    if (connected) {
+        // Everything claimed that self didn't reach was reached by enemy
+        // only. The players are connected if one of those squares (or
+        // enemy's own) is next to a square self reached. Contested squares
+        // count as self's, but the first contested square on enemy's way
+        // in is always next to one of enemy's.
+        Bitboard &enemyOnly = *outSelf;
+        uint64_t *e = enemyOnly.words();
+        const uint64_t *r = reached.words();
+        for (int i = 0; i < walls.size(); ++i)
+            e[i] = ~u[i] & ~w[i] & ~r[i];
+        enemyOnly.set(enemy);
+
+        bbNeighbours(*outEnemy, reached);
+        const uint64_t *n = outEnemy->words();
+        *connected = false;
+        for (int i = 0; i < walls.size(); ++i) {
+            if (n[i] & e[i]) {
+                *connected = true;
+                break;
+            }
+        }
+    }
+
+    return ownSelf - ownEnemy;
+}
+
+// the distance of a wall, or of a square a player can't get to
+static const int32_t UNREACHED = 1 << 29;
+
+IncrementalVoronoi::IncrementalVoronoi() :
+    width(0), height(0), rowCells(0), generation(0)
+{
+    offset[0] = offset[1] = 0;
+    head[0] = head[1] = 0;
+}
+
+inline int IncrementalVoronoi::cell(position pos) const
+{
+    return (pos.y + 1) * rowCells + pos.x + 1;
+}
+
+inline int32_t IncrementalVoronoi::distance(int player, int c) const
+{
+    int32_t d = dist[player][c];
+    return d == UNREACHED ? UNREACHED : d + offset[player];
+}
+
+inline void IncrementalVoronoi::setDistance(int player, int c, int32_t value)
+{
+    int32_t stored = value == UNREACHED ? UNREACHED : value - offset[player];
+    if (dist[player][c] == stored)
+        return;
+    Change change = {c, player, dist[player][c]};
+    changes.push_back(change);
+    dist[player][c] = stored;
+}
+
+void IncrementalVoronoi::nextGeneration()
+{
+    if (++generation == 0) {
+        std::fill(affectedMark.begin(), affectedMark.end(), 0);
+        std::fill(checkedMark.begin(), checkedMark.end(), 0);
+        generation = 1;
+    }
+}
+
+// a plain breadth first search from the player's square
+void IncrementalVoronoi::fill(int player)
+{
+    std::vector<int32_t> &d = dist[player];
+    std::fill(d.begin(), d.end(), UNREACHED);
+    d[head[player]] = 0;
+
+    const int step[4] = {1, -1, rowCells, -rowCells};
+    queue.clear();
+    queue.push_back(head[player]);
+    for (size_t i = 0; i < queue.size(); ++i) {
+        int c = queue[i];
+        for (int k = 0; k < 4; ++k) {
+            int n = c + step[k];
+            if (!blocked[n] && d[n] == UNREACHED) {
+                d[n] = d[c] + 1;
+                queue.push_back(n);
+            }
+        }
+    }
+}
+
+void IncrementalVoronoi::reset(const Bitboard &walls, position self,
+        position enemy)
+{
+    width = walls.width();
+    height = walls.height();
+    rowCells = walls.stride() * 64;
+
+    const int cells = walls.cells();
+    blocked.resize(cells);
+    for (int c = 0; c < cells; ++c)
+        blocked[c] = walls.test(c);
+    for (int p = 0; p < 2; ++p) {
+        dist[p].resize(cells);
+        offset[p] = 0;
+    }
+    affectedMark.assign(cells, 0);
+    checkedMark.assign(cells, 0);
+    tentative.resize(cells);
+    generation = 0;
+    changes.clear();
+    frames.clear();
+
+    head[0] = cell(self);
+    head[1] = cell(enemy);
+    blocked[head[0]] = blocked[head[1]] = 1;
+    fill(0);
+    fill(1);
+}
+
+// whether a square keeps a shortest path that avoids the affected squares
+inline bool IncrementalVoronoi::supported(int player, int c) const
+{
+    int32_t want = distance(player, c) - 1;
+    const int step[4] = {1, -1, rowCells, -rowCells};
+    for (int k = 0; k < 4; ++k) {
+        int n = c + step[k];
+        if (affectedMark[n] != generation && distance(player, n) == want)
+            return true;
+    }
+    return false;
+}
+
+// Grows affected, which holds the squares where the shortest paths were
+// cut, to every square below them that has no shortest path left. affected
+// stays in order of distance, so a square's parents have all been decided
+// by the time it is looked at.
+void IncrementalVoronoi::collectAffected(int player)
+{
+    const int step[4] = {1, -1, rowCells, -rowCells};
+    for (size_t i = 0; i < affected.size(); ++i) {
+        int a = affected[i];
+        int32_t below = distance(player, a) + 1;
+        for (int k = 0; k < 4; ++k) {
+            int n = a + step[k];
+            if (affectedMark[n] == generation || checkedMark[n] == generation ||
+                    distance(player, n) != below)
+                continue;
+            checkedMark[n] = generation;
+            if (!supported(player, n)) {
+                affectedMark[n] = generation;
+                affected.push_back(n);
+            }
+        }
+    }
+}
+
+// Works out the affected squares' distances again from the squares around
+// them, which are right already: each starts from its best neighbour
+// outside, and then they are settled in order of distance (the seeds sorted,
+// and what they reach in a queue behind them, which comes out in order since
+// every edge is one step).
+void IncrementalVoronoi::recompute(int player)
+{
+    const int step[4] = {1, -1, rowCells, -rowCells};
+    seeds.clear();
+    for (size_t i = 0; i < affected.size(); ++i) {
+        int a = affected[i];
+        int32_t best = UNREACHED;
+        if (!blocked[a]) {
+            for (int k = 0; k < 4; ++k) {
+                int n = a + step[k];
+                if (affectedMark[n] == generation)
+                    continue;
+                int32_t d = distance(player, n);
+                if (d < UNREACHED && d + 1 < best)
+                    best = d + 1;
+            }
+        }
+        tentative[a] = best;
+        if (best < UNREACHED)
+            seeds.push_back(std::make_pair(best, a));
+    }
+    std::sort(seeds.begin(), seeds.end());
+
+    queue.clear();
+    size_t s = 0, q = 0;
+    while (s < seeds.size() || q < queue.size()) {
+        int c;
+        if (q < queue.size() &&
+                (s == seeds.size() || tentative[queue[q]] <= seeds[s].first)) {
+            c = queue[q++];
+        } else {
+            c = seeds[s].second;
+            // superseded by a shorter way in found since
+            if (seeds[s++].first != tentative[c])
+                continue;
+        }
+
+        int32_t next = tentative[c] + 1;
+        for (int k = 0; k < 4; ++k) {
+            int n = c + step[k];
+            if (affectedMark[n] == generation && !blocked[n] &&
+                    next < tentative[n]) {
+                tentative[n] = next;
+                queue.push_back(n);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < affected.size(); ++i)
+        setDistance(player, affected[i], tentative[affected[i]]);
+}
+
+void IncrementalVoronoi::move(int player, position to)
+{
+    int other = 1 - player;
+    int from = head[player];
+    int t = cell(to);
+
+    Frame frame = {changes.size(), player, from, offset[player]};
+    frames.push_back(frame);
+    blocked[t] = 1;
+
+    // the other player can't go through t any more
+    if (dist[other][t] != UNREACHED) {
+        nextGeneration();
+        affected.clear();
+        affected.push_back(t);
+        affectedMark[t] = generation;
+        collectAffected(other);
+        recompute(other);
+    }
+
+    // The mover starts from t now. Squares with a shortest path through t
+    // are a step closer, which the offset takes care of; the rest had all
+    // their shortest paths through the way from, which is a wall now.
+    nextGeneration();
+    affected.clear();
+    affected.push_back(from);
+    affectedMark[from] = generation;
+    checkedMark[t] = generation;
+    collectAffected(player);
+    --offset[player];
+    recompute(player);
+
+    head[player] = t;
+}
+
+void IncrementalVoronoi::unmove()
+{
+    const Frame &frame = frames.back();
+    while (changes.size() > frame.changes) {
+        const Change &change = changes.back();
+        dist[change.player][change.cell] = change.old;
+        changes.pop_back();
+    }
+    blocked[head[frame.player]] = 0;
+    head[frame.player] = frame.from;
+    offset[frame.player] = frame.offset;
+    frames.pop_back();
+}
+
+int IncrementalVoronoi::score(bool *connected) const
+{
+    // self owns a square if dist[0] + offset[0] < dist[1] + offset[1]; the
+    // difference of two UNREACHEDs is 0, which the checks for them rule out
+    const int32_t *d0 = &dist[0][0], *d1 = &dist[1][0];
+    const int32_t k = offset[1] - offset[0];
+    int own[2] = {0, 0};
+    for (int y = 1; y <= height; ++y) {
+        int row = y * rowCells;
+        for (int c = row + 1; c <= row + width; ++c) {
+            int32_t diff = d0[c] - d1[c];
+            own[0] += d0[c] != UNREACHED && diff < k;
+            own[1] += d1[c] != UNREACHED && diff > k;
+        }
+    }
+
+    if (connected) {
+        const int step[4] = {1, -1, rowCells, -rowCells};
+        *connected = false;
+        for (int i = 0; i < 4; ++i) {
+            int n = head[1] + step[i];
+            if (n == head[0] || (!blocked[n] && d0[n] != UNREACHED))
+                *connected = true;
+        }
+    }
+    return own[0] - own[1];
+}
@@ -0,0 +1,121 @@
+#ifndef VORONOI_H
+#define VORONOI_H
+
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+#include "Bitboard.h"
+
+// One step of the territory flood fill: grows both players' frontiers by one
+// square into the unclaimed squares, a word at a time. The fronts in inSelf
+// and inEnemy may only be non-zero in words [*lo, *hi); the new fronts are
+// written to outSelf and outEnemy (which must be zero on entry), claimed
+// squares are removed from unclaimed, and [*lo, *hi) is narrowed or widened
+// to cover the new fronts. A square reached by both players on the same step
+// is contested and counts for neither side.
+typedef void (*VoronoiStep)(const uint64_t *inSelf, const uint64_t *inEnemy,
+        uint64_t *outSelf, uint64_t *outEnemy, uint64_t *unclaimed,
+        int stride, int end, int *lo, int *hi, int *ownSelf, int *ownEnemy);
+
+void voronoiStepScalar(const uint64_t *inSelf, const uint64_t *inEnemy,
+        uint64_t *outSelf, uint64_t *outEnemy, uint64_t *unclaimed,
+        int stride, int end, int *lo, int *hi, int *ownSelf, int *ownEnemy);
+
+// the vector versions are NULL when the cpu (or compiler) can't run them
+extern const VoronoiStep voronoiStepSSE2;
+extern const VoronoiStep voronoiStepAVX2;
+
+// the fastest step the cpu supports
+VoronoiStep voronoiBestStep();
+
+// Squares self can reach before enemy minus squares enemy can reach before
+// self, by growing both frontiers together. walls must include both players'
+// squares. If connected is given it is set to whether the players can reach
+// each other, which costs one more pass over the board but saves a separate
+// flood fill.
+int bbVoronoi(const Bitboard &walls, position self, position enemy,
+        bool *connected = NULL, VoronoiStep step = voronoiBestStep());
+
+// The territory bbVoronoi counts, kept up to date as moves are made and
+// taken back instead of being worked out again for every position. Both
+// players' distances to every square are kept, and a move only rewrites
+// the ones it changes, remembering the old values so that unmove() can put
+// them back.
+//
+// The square moved into is a wall to the other player now, which only
+// changes the squares all of whose shortest paths went through it. The
+// mover's distances drop by one wherever a shortest path went through its
+// new square, which is kept as an offset rather than written out, so only
+// the squares it was closer to some other way (behind it and to its sides
+// in an open room, and little once its trail hems it in) are worked out
+// again. Counting what each side owns still looks at every square, but
+// only compares two numbers for each.
+class IncrementalVoronoi
+{
+    public:
+        IncrementalVoronoi();
+
+        // starts over from a position, forgetting any moves made
+        void reset(const Bitboard &walls, position self, position enemy);
+
+        // player 0 (self) or 1 (enemy) moves to to, a free square next to
+        // it, and unmove() takes back the last move
+        void move(int player, position to);
+        void unmove();
+
+        // what bbVoronoi would return for the current position
+        int score(bool *connected) const;
+
+    private:
+        int width, height;
+        int rowCells; // cells from one row of the board to the next
+
+        // walls (including both players' squares) by cell
+        std::vector<uint8_t> blocked;
+
+        // Distances by cell, UNREACHED for walls and squares a player can't
+        // get to. Anything else is offset[player] short of the distance.
+        std::vector<int32_t> dist[2];
+        int offset[2];
+        int head[2];
+
+        int cell(position pos) const;
+        int32_t distance(int player, int c) const;
+        void setDistance(int player, int c, int32_t value);
+
+        // old values, for unmove()
+        struct Change
+        {
+            int cell;
+            int player;
+            int32_t old;
+        };
+        struct Frame
+        {
+            size_t changes;
+            int player;
+            int from;
+            int offset;
+        };
+        std::vector<Change> changes;
+        std::vector<Frame> frames;
+
+        // The squares a move may have changed the distances of, found by
+        // walking out from where the shortest paths were cut, as marked with
+        // the current generation. checked holds the squares found not to be.
+        uint32_t generation;
+        std::vector<uint32_t> affectedMark, checkedMark;
+        std::vector<int> affected;
+        std::vector<int32_t> tentative;
+        std::vector<std::pair<int32_t, int> > seeds;
+        std::vector<int> queue;
+
+        void nextGeneration();
+        bool supported(int player, int c) const;
+        void collectAffected(int player);
+        void recompute(int player);
+        void fill(int player);
+};
+
+#endif